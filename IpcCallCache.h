@@ -0,0 +1,163 @@
+// Server-side result cache of pure functions.
+//
+// A function that is registered with 'IPC_CALL_REGISTER_CACHED(f, capacity, ttl)' has an LRU cache of its replies,
+// keyed by the request bytes after the function ID, so a call with the same arguments returns the cached reply
+// without unserializing the parameters, executing the function and serializing the reply.
+// The reply contains 'out' parameters, they depend only on the arguments of a pure function, so they are cached too.
+// Hits and misses are counted in 'FunctionMetrics::cacheHits' and 'FunctionMetrics::cacheMisses'.
+//
+//   std::string Lookup(const std::string& key);
+//   IPC_CALL_REGISTER_CACHED(Lookup, 10000, std::chrono::seconds(30));
+//
+// 'ttl' 0 means that replies don't expire, they are only evicted.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "IpcCallData.h"
+
+namespace IpcCall {
+  // The cache is split into 'ShardCount' shards by the hash of the key, every shard has its own mutex and LRU list,
+  // so calls with different arguments rarely contend.
+  class ResultCache {
+  public:
+    static constexpr size_t ShardCount = 16;
+
+    using Clock = std::chrono::steady_clock;
+
+    // The reply depends on the arguments, and on the format and the encoding of the request.
+    // 'string_view' and 'span' arguments are padded relative to the beginning of the message, so the padding depends
+    // on the header, which is longer with a call ID or a deadline. The offsets of the arguments and of the reply
+    // modulo 'Alignment' are a part of the key, the same arguments at such offsets have the same bytes.
+    struct Key {
+      static constexpr size_t Alignment = 64;
+
+      // It is not a varint, the function ID is not a part of the key.
+      static Key Of(const Unserializer& unserializer, size_t replyOffset) {
+        return { std::string_view(reinterpret_cast<const char*>(unserializer.Data()), unserializer.Available()),
+                 unserializer.GetFormat(), unserializer.IsCompact(),
+                 static_cast<uint8_t>(unserializer.Offset() % Alignment), static_cast<uint8_t>(replyOffset % Alignment) };
+      }
+
+      bool operator == (const Key& other) const {
+        return format == other.format && compact == other.compact && argsPhase == other.argsPhase &&
+               replyPhase == other.replyPhase && args == other.args;
+      }
+
+      size_t Hash() const {
+        const size_t h = std::hash<std::string_view>()(args);
+        return h ^ ((static_cast<size_t>(format) << 16 | size_t(compact) << 15 | size_t(argsPhase) << 8 | replyPhase) * 0x9E3779B97F4A7C15ull);
+      }
+
+      std::string_view args;
+      Format format;
+      bool compact;
+      uint8_t argsPhase;
+      uint8_t replyPhase;
+    };
+
+    ResultCache(size_t capacity, Clock::duration ttl) :
+      shardCapacity_(std::max<size_t>(1, (capacity + ShardCount - 1) / ShardCount)), ttl_(ttl) {}
+
+    // Appends the cached reply of 'key' to 'serializer', returns false if it is not cached or expired.
+    bool Find(const Key& key, Serializer& serializer) {
+      auto& shard = ShardOf(key);
+
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      const auto it = shard.entries.find(key);
+      if (it == shard.entries.end()) {
+        return false;
+      }
+
+      const auto entry = it->second;
+
+      if (ttl_ != Clock::duration::zero() && Clock::now() >= entry->expires) {
+        shard.entries.erase(it);
+        shard.lru.erase(entry);
+
+        return false;
+      }
+
+      // The most recently used is the first.
+      shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+
+      serializer.Write(entry->reply.data(), entry->reply.size());
+
+      return true;
+    }
+
+    // 'reply' is without the call ID of a pipelined call, it is not the same for the same arguments.
+    void Insert(const Key& key, const uint8_t* reply, size_t size) {
+      auto& shard = ShardOf(key);
+
+      const auto expires = ttl_ != Clock::duration::zero() ? Clock::now() + ttl_ : Clock::time_point::max();
+
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      // Another thread can insert it after 'Find'.
+      const auto it = shard.entries.find(key);
+      if (it != shard.entries.end()) {
+        const auto entry = it->second;
+
+        entry->reply.assign(reply, reply + size);
+        entry->expires = expires;
+
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+
+        return;
+      }
+
+      if (shard.entries.size() >= shardCapacity_) {
+        shard.entries.erase(shard.lru.back().key);
+        shard.lru.pop_back();
+      }
+
+      shard.lru.push_front({ std::string(key.args), key, bytes_t(reply, reply + size), expires });
+
+      auto& entry = shard.lru.front();
+      entry.key.args = entry.args;
+
+      shard.entries.emplace(entry.key, shard.lru.begin());
+    }
+
+  private:
+    struct Entry {
+      std::string args;
+      Key key; // 'args' is a view of 'Entry::args'.
+      bytes_t reply;
+      Clock::time_point expires;
+    };
+
+    struct KeyHash {
+      size_t operator () (const Key& key) const {
+        return key.Hash();
+      }
+    };
+
+    // 'entries' keys are 'Entry::key' in 'lru'.
+    struct Shard {
+      std::mutex mutex;
+      std::list<Entry> lru;
+      std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+    };
+
+    Shard& ShardOf(const Key& key) {
+      return shards_[key.Hash() % ShardCount];
+    }
+
+    const size_t shardCapacity_;
+    const Clock::duration ttl_;
+
+    std::array<Shard, ShardCount> shards_;
+  };
+}
@@ -0,0 +1,474 @@
+// Capture of the requests that reach the server, and their replay for load testing (Linux).
+//
+// 'Capture' is a 'Server::IRecorder' that appends every request (its time, function ID, bytes, reply size and latency)
+// to a memory-mapped file. The file is split into segments, a thread appends to its own segment without locks
+// and takes the next free segment with an atomic increment, so the capture can stay on in production.
+// 'Close' writes an index of the records in the order of their times.
+//
+//   IpcCall::Capture capture("requests.ipccap");
+//   IpcCall::Server::SetRecorder(&capture);
+//   ...
+//   IpcCall::Server::SetRecorder(nullptr);
+//   capture.Close();
+//
+// 'Replay' maps the file and re-issues the requests to 'Server::SyncCall' and 'Server::AsyncCall' on several threads,
+// at the original pacing or faster. The process should register the same functions as the captured server.
+//
+//   IpcCall::Replay::Result result = IpcCall::Replay("requests.ipccap").Run(4, 10.0); // 4 threads, 10 times faster
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "IpcCallServer.h"
+
+namespace IpcCall {
+  // A capture file is 'CaptureFile' in the first 'HeaderSize' bytes, segments of 'segmentSize' bytes, then the index,
+  // the offsets of the records from the beginning of the file in the order of their times.
+  struct CaptureFile {
+    static constexpr char Magic[8] = "IPCCAP1";
+    static constexpr size_t HeaderSize = 4096;
+
+    char magic[8];
+    uint64_t segmentSize;
+    uint64_t segmentCount;
+    std::atomic<uint64_t> allocated; // Segments that are taken by threads, it can be more than 'segmentCount'.
+    std::atomic<uint64_t> dropped;   // Records that didn't fit.
+    uint64_t indexOffset;            // 0 if the capture was not closed, then the segments are scanned.
+    uint64_t indexCount;
+  };
+
+  // A segment starts with the number of its bytes that are written, including the counter, then records follow.
+  // A record is followed by the request, padded to a multiple of 8 bytes.
+  struct CaptureRecord {
+    static constexpr size_t SegmentHeaderSize = sizeof(uint64_t);
+
+    uint64_t timeNs;  // From the start of the capture.
+    uint64_t latencyNs;
+    uint32_t requestBytes;
+    uint32_t replyBytes;
+    func_id_t funcId; // 0 for a batch.
+    uint8_t sync;
+    uint8_t failed;   // The call threw.
+    uint16_t reserved;
+
+    static size_t Size(size_t requestBytes) {
+      return sizeof(CaptureRecord) + (requestBytes + 7) / 8 * 8;
+    }
+
+    // Offsets of the records of 'segments' in the order of their times.
+    static std::vector<uint64_t> Index(const uint8_t* file, size_t fileSize, uint64_t segmentSize, uint64_t segments) {
+      std::vector<uint64_t> index;
+
+      for (uint64_t i = 0; i < segments; i++) {
+        const uint64_t segment = CaptureFile::HeaderSize + i * segmentSize;
+        if (segment + segmentSize > fileSize) {
+          break;
+        }
+
+        const uint64_t used = std::min(reinterpret_cast<const std::atomic<uint64_t>*>(file + segment)->load(std::memory_order_acquire), segmentSize);
+
+        for (uint64_t offset = SegmentHeaderSize; offset + sizeof(CaptureRecord) <= used; ) {
+          CaptureRecord record;
+          memcpy(&record, file + segment + offset, sizeof(record));
+
+          if (offset + Size(record.requestBytes) > used) {
+            break;
+          }
+
+          index.push_back(segment + offset);
+          offset += Size(record.requestBytes);
+        }
+      }
+
+      std::stable_sort(index.begin(), index.end(), [file](uint64_t a, uint64_t b) {
+        uint64_t timeA, timeB;
+        memcpy(&timeA, file + a, sizeof(timeA));
+        memcpy(&timeB, file + b, sizeof(timeB));
+
+        return timeA < timeB;
+      });
+
+      return index;
+    }
+  };
+
+  class Capture: public Server::IRecorder {
+  public:
+    // 'capacity' bytes of 'path' are mapped, the file is sparse. A record that doesn't fit is dropped.
+    explicit Capture(const std::string& path, size_t capacity = size_t(1) << 30, size_t segmentSize = size_t(1) << 20) :
+      segmentSize_(std::max<size_t>((segmentSize + 4095) / 4096 * 4096, 4096)),
+      segmentCount_(std::max<size_t>(capacity, CaptureFile::HeaderSize + segmentSize_) / segmentSize_),
+      size_(CaptureFile::HeaderSize + segmentCount_ * segmentSize_), id_(NextId()) {
+      fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "IPC capture can't create '" + path + "'");
+      }
+
+      void* data = MAP_FAILED;
+      if (ftruncate(fd_, size_) == 0) {
+        data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+      }
+
+      if (data == MAP_FAILED) {
+        const int error = errno;
+        close(fd_);
+
+        throw std::system_error(error, std::generic_category(), "IPC capture can't map '" + path + "'");
+      }
+
+      data_ = static_cast<uint8_t*>(data);
+
+      file_ = new (data_) CaptureFile();
+      memcpy(file_->magic, CaptureFile::Magic, sizeof(file_->magic));
+      file_->segmentSize = segmentSize_;
+      file_->segmentCount = segmentCount_;
+
+      start_ = std::chrono::steady_clock::now();
+    }
+
+    Capture(const Capture&) = delete;
+    Capture& operator=(const Capture&) = delete;
+
+    ~Capture() {
+      try {
+        Close();
+      } catch (...) {
+      }
+    }
+
+    void Record(const bytes_t& request, bool sync, std::chrono::steady_clock::time_point start,
+                std::chrono::nanoseconds latency, size_t replyBytes, bool failed) override {
+      const size_t size = CaptureRecord::Size(request.size());
+
+      auto& local = Local();
+      if (local.captureId != id_ || local.used + size > segmentSize_) {
+        if (!NextSegment(local, size)) {
+          file_->dropped.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+      }
+
+      const CaptureRecord record = {
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(start - start_).count()),
+        static_cast<uint64_t>(latency.count()),
+        static_cast<uint32_t>(request.size()), static_cast<uint32_t>(replyBytes),
+        RequestFunctionId(request), sync, failed, 0
+      };
+
+      uint8_t* data = local.segment + local.used;
+      memcpy(data, &record, sizeof(record));
+      memcpy(data + sizeof(record), request.data(), request.size());
+
+      // The record is visible to a reader of a capture that was not closed.
+      local.used += size;
+      reinterpret_cast<std::atomic<uint64_t>*>(local.segment)->store(local.used, std::memory_order_release);
+    }
+
+    uint64_t Dropped() const {
+      return file_ ? file_->dropped.load(std::memory_order_relaxed) : dropped_;
+    }
+
+    // Stops recording, if it is the recorder of 'Server', then writes the index and closes the file.
+    void Close() {
+      if (data_ == nullptr) {
+        return;
+      }
+
+      // The segments are unmapped after the calls of 'Record' that are in progress return.
+      Server::RemoveRecorder(this);
+
+      const uint64_t segments = std::min<uint64_t>(file_->allocated.load(), segmentCount_);
+      const auto index = CaptureRecord::Index(data_, size_, segmentSize_, segments);
+
+      // Segments that are not taken are cut off.
+      const uint64_t indexOffset = CaptureFile::HeaderSize + segments * segmentSize_;
+      const size_t indexBytes = index.size() * sizeof(uint64_t);
+
+      int error = 0;
+      if (ftruncate(fd_, indexOffset) != 0 || pwrite(fd_, index.data(), indexBytes, indexOffset) != static_cast<ssize_t>(indexBytes)) {
+        error = errno ? errno : EIO;
+      } else {
+        file_->indexOffset = indexOffset;
+        file_->indexCount = index.size();
+      }
+
+      dropped_ = file_->dropped.load();
+
+      munmap(data_, size_);
+      close(fd_);
+
+      data_ = nullptr;
+      file_ = nullptr;
+
+      if (error) {
+        throw std::system_error(error, std::generic_category(), "IPC capture can't write the index");
+      }
+    }
+
+    // Function ID of 'request', 0 for a batch or a request that can't be parsed.
+    static func_id_t RequestFunctionId(const bytes_t& request) {
+      try {
+        Unserializer unserializer(request);
+
+        Header header;
+        unserializer >> header;
+
+        if (header.flags & IsBatch) {
+          return 0;
+        }
+
+        if (header.flags & HasFunctionId) {
+          func_id_t funcId;
+          unserializer.Unserialize(funcId);
+
+          return funcId;
+        }
+
+        std::string_view funcName;
+        unserializer >> funcName;
+
+        return FunctionId(funcName);
+      } catch (...) {
+        return 0;
+      }
+    }
+
+  private:
+    // Segment of the current thread, it is of the capture with 'captureId'.
+    struct LocalSegment {
+      uint64_t captureId = 0;
+      uint8_t* segment = nullptr;
+      size_t used = 0;
+    };
+
+    static LocalSegment& Local() {
+      static thread_local LocalSegment s_local;
+      return s_local;
+    }
+
+    static uint64_t NextId() {
+      static std::atomic<uint64_t> s_id{0};
+      return ++s_id;
+    }
+
+    bool NextSegment(LocalSegment& local, size_t size) {
+      if (size > segmentSize_ - CaptureRecord::SegmentHeaderSize || full_.load(std::memory_order_relaxed)) {
+        return false;
+      }
+
+      const uint64_t segment = file_->allocated.fetch_add(1, std::memory_order_relaxed);
+      if (segment >= segmentCount_) {
+        full_.store(true, std::memory_order_relaxed);
+        return false;
+      }
+
+      local = { id_, data_ + CaptureFile::HeaderSize + segment * segmentSize_, CaptureRecord::SegmentHeaderSize };
+
+      return true;
+    }
+
+    const size_t segmentSize_;
+    const size_t segmentCount_;
+    const size_t size_;
+    const uint64_t id_;
+
+    int fd_ = -1;
+    uint8_t* data_ = nullptr;
+    CaptureFile* file_ = nullptr;
+    std::chrono::steady_clock::time_point start_;
+    std::atomic<bool> full_{false};
+    uint64_t dropped_ = 0;
+  };
+
+  class Replay {
+  public:
+    struct Frame {
+      std::chrono::nanoseconds time;    // From the first frame.
+      std::chrono::nanoseconds latency; // Of the captured call.
+      func_id_t funcId;
+      bool sync;
+      bool failed;
+      size_t replyBytes;
+      const uint8_t* request;
+      size_t requestBytes;
+    };
+
+    struct Result {
+      uint64_t calls = 0;
+      uint64_t errors = 0;          // Calls that threw.
+      uint64_t replyMismatches = 0; // Replies of a different size than the captured reply.
+      std::chrono::nanoseconds elapsed{0};
+      LatencyHistogram latency;
+    };
+
+    // The index of a capture that was not closed is built by scanning its segments.
+    explicit Replay(const std::string& path) {
+      fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "IPC replay can't open '" + path + "'");
+      }
+
+      struct stat st;
+      void* data = MAP_FAILED;
+      if (fstat(fd_, &st) == 0 && static_cast<size_t>(st.st_size) >= CaptureFile::HeaderSize) {
+        size_ = st.st_size;
+        data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      }
+
+      if (data == MAP_FAILED) {
+        close(fd_);
+        throw std::runtime_error("IPC replay can't map '" + path + "'");
+      }
+
+      data_ = static_cast<const uint8_t*>(data);
+
+      const auto file = reinterpret_cast<const CaptureFile*>(data_);
+      if (memcmp(file->magic, CaptureFile::Magic, sizeof(file->magic)) != 0 || file->segmentSize == 0) {
+        Unmap();
+        throw std::runtime_error("IPC replay '" + path + "' is not a capture");
+      }
+
+      dropped_ = file->dropped.load();
+
+      std::vector<uint64_t> index;
+      if (file->indexOffset && file->indexOffset + file->indexCount * sizeof(uint64_t) <= size_) {
+        index.resize(file->indexCount);
+        memcpy(index.data(), data_ + file->indexOffset, index.size() * sizeof(uint64_t));
+      } else {
+        index = CaptureRecord::Index(data_, size_, file->segmentSize, std::min<uint64_t>(file->allocated.load(), file->segmentCount));
+      }
+
+      for (const auto offset : index) {
+        CaptureRecord record;
+        if (offset + sizeof(record) > size_) {
+          continue;
+        }
+
+        memcpy(&record, data_ + offset, sizeof(record));
+
+        if (offset + sizeof(record) + record.requestBytes > size_) {
+          continue;
+        }
+
+        const auto time = std::chrono::nanoseconds(record.timeNs - (frames_.empty() ? record.timeNs : first_));
+        if (frames_.empty()) {
+          first_ = record.timeNs;
+        }
+
+        frames_.push_back({ time, std::chrono::nanoseconds(record.latencyNs), record.funcId, record.sync != 0, record.failed != 0,
+                            record.replyBytes, data_ + offset + sizeof(record), record.requestBytes });
+      }
+    }
+
+    Replay(const Replay&) = delete;
+    Replay& operator=(const Replay&) = delete;
+
+    ~Replay() {
+      Unmap();
+    }
+
+    const std::vector<Frame>& Frames() const {
+      return frames_;
+    }
+
+    // Records that were dropped by the capture.
+    uint64_t Dropped() const {
+      return dropped_;
+    }
+
+    // Re-issues the frames on 'threads' threads. 'speed' 1 keeps the original pacing, 10 is 10 times faster,
+    // 0 is as fast as possible. A frame is not issued before its time, it can be later if the threads are busy.
+    Result Run(unsigned threads, double speed) const {
+      std::atomic<size_t> next{0};
+      std::vector<Result> results(std::max(threads, 1u));
+      std::vector<std::thread> workers;
+
+      const auto start = std::chrono::steady_clock::now();
+
+      for (auto& result : results) {
+        workers.emplace_back([&] {
+          bytes_t request;
+
+          for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < frames_.size(); ) {
+            const auto& frame = frames_[i];
+
+            if (speed > 0) {
+              std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::nanoseconds>(frame.time / speed));
+            }
+
+            request.assign(frame.request, frame.request + frame.requestBytes);
+
+            const auto callStart = std::chrono::steady_clock::now();
+
+            // A request carries the time that was left until its deadline, it is counted from the replayed call.
+            try {
+              if (frame.sync) {
+                auto reply = Server::SyncCall(request, callStart);
+
+                if (!frame.failed && reply.size() != frame.replyBytes) {
+                  result.replyMismatches++;
+                }
+
+                BufferPool::Release(std::move(reply));
+              } else {
+                Server::AsyncCall(request, callStart);
+              }
+            } catch (...) {
+              result.errors++;
+            }
+
+            result.latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - callStart).count());
+            result.calls++;
+          }
+        });
+      }
+
+      for (auto& worker : workers) {
+        worker.join();
+      }
+
+      Result ret;
+      ret.elapsed = std::chrono::steady_clock::now() - start;
+
+      for (const auto& result : results) {
+        ret.calls += result.calls;
+        ret.errors += result.errors;
+        ret.replyMismatches += result.replyMismatches;
+        ret.latency.Merge(result.latency);
+      }
+
+      return ret;
+    }
+
+  private:
+    void Unmap() {
+      if (data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+        close(fd_);
+
+        data_ = nullptr;
+      }
+    }
+
+    int fd_ = -1;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    uint64_t dropped_ = 0;
+    uint64_t first_ = 0;
+    std::vector<Frame> frames_;
+  };
+}
@@ -1,54 +1,189 @@
 #pragma once 
 
+#include <atomic>
+#include <future>
+#include <memory>
 #include <utility>
 
 #include "IpcCallData.h"
+#include "IpcCallStream.h"
+
+#ifdef __cpp_lib_coroutine
+#include <coroutine>
+#endif
+
+// Format of the requests sent by the client.
+// 'IpcCall::Format::Legacy' is needed only for a server that is built without 'IpcCall::Header' support.
+#ifndef IPC_CALL_FORMAT
+#define IPC_CALL_FORMAT IpcCall::Format::Latest
+#endif
+
+// Compact encoding of the requests and their replies, integers and lengths are varints, see 'IpcCall::HeaderFlags::Compact'.
+// It is smaller for small values and costs some CPU, it is ignored for a format before 'IpcCall::Format::Flags'.
+#ifndef IPC_CALL_COMPACT
+#define IPC_CALL_COMPACT false
+#endif
 
 namespace IpcCall {
+  // Argument of a parameter, it is kept by reference until it is serialized, so an argument of a parameter by value is not copied.
+  template <typename Param>
+  using ArgRef = std::conditional_t<std::is_reference_v<Param>, Param, const Param&>;
+
+  // ID of a pipelined call, it is unique in the process.
+  inline call_id_t NextCallId() {
+    static std::atomic<call_id_t> s_nextCallId = 1;
+    return s_nextCallId.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Serializes 'Header' and the function name or ID, and reserves the request including 'paramsSize'.
+  // 'callId' is not 0 for a pipelined call. The request has the 'Deadline' of the thread.
+  inline void SerializeRequestHeader(Serializer& serializer, std::string_view funcName, func_id_t funcId, size_t paramsSize, call_id_t callId = 0) {
+    Header header{ IPC_CALL_FORMAT };
+
+    const auto deadline = Deadline::Current();
+    if (Deadline::Expired(deadline)) {
+      throw DeadlineExceeded();
+    }
+
+    if (callId != 0) {
+      if (header.format < Format::Flags) {
+        throw std::logic_error("Pipelined IPC call requires 'IpcCall::Format::Flags'");
+      }
+
+      header.flags |= HasCallId;
+      header.callId = callId;
+    }
+
+    if (header.format >= Format::Flags) {
+      header.flags |= HasFunctionId;
+
+      if (deadline != 0) {
+        header.flags |= HasDeadline;
+        header.deadline = Deadline::Remaining(deadline);
+      }
+
+      if (IPC_CALL_COMPACT) {
+        header.flags |= Compact;
+      }
+
+      // The function ID is not a varint, it is a hash.
+      serializer.Reserve(SizeOf(header, header.format) + sizeof(funcId) + paramsSize);
+      serializer << header;
+      serializer.Serialize(funcId);
+    } else {
+      serializer.Reserve(SizeOf(header, header.format) + SizeOf(funcName, header.format) + paramsSize);
+      serializer << header << funcName;
+    }
+  }
+
   // 'IPC_SEND_RECEIVE' calls 'SyncCall'.
   template <typename> struct SyncCall;
 
   template <typename Ret, typename ...Params>
   struct SyncCall<Ret(*)(Params...)> {
-    SyncCall(const std::string& funcName) : funcName_(funcName) {}
+    using ParamsSerializedSize = SerializedSize<std::tuple<std::decay_t<Params>...>>;
 
-    auto operator()(Params... params) {
-      if constexpr (0 == sizeof...(Params)) {
-        return TupleWithParamsProxy<decltype(std::tuple<>())>(funcName_, std::tuple<>());
-      } else {
-        const auto tupleWithParams = std::tuple<Params...>(std::forward<Params>(params)...);
+    SyncCall(std::string_view funcName, func_id_t funcId) : funcName_(funcName), funcId_(funcId) {}
 
-        return TupleWithParamsProxy<decltype(tupleWithParams)>(funcName_, tupleWithParams);
-      }
+    auto operator()(ArgRef<Params>... params) {
+      return TupleWithParamsProxy<std::tuple<ArgRef<Params>...>>(funcName_, funcId_, std::tuple<ArgRef<Params>...>(std::forward<ArgRef<Params>>(params)...));
     }
 
     template <typename TupleWithParams>
     struct TupleWithParamsProxy {
       static constexpr auto TupleSize = std::tuple_size_v<TupleWithParams>;
 
-      TupleWithParamsProxy(const std::string& funcName, const TupleWithParams& tupleWithParams) :
-        funcName_(funcName), tupleWithParams_(tupleWithParams) {}
+      TupleWithParamsProxy(std::string_view funcName, func_id_t funcId, TupleWithParams&& tupleWithParams) :
+        funcName_(funcName), funcId_(funcId), tupleWithParams_(std::move(tupleWithParams)) {}
 
-      // 'ipcSync' is a pointer to the IPC transport function, it is the last argument in 'IPC_SYNC_CALL'.
-      Ret operator() (std::vector<uint8_t>(ipcSync)(const std::vector<uint8_t>&)) {
-        Serializer serializer;
+      // 'ipcSync' is the IPC transport function or function object, it is the last argument in 'IPC_SEND_RECEIVE'.
+      // For a call with 'InStream' parameter or 'OutStream' return, it is a streaming transport that opens 'StreamChannel'.
+      template <typename IpcSync>
+      Ret operator() (IpcSync&& ipcSync) {
+        if constexpr (IsStreamingCall<Ret, Params...>()) {
+          return StreamCall(ipcSync());
+        } else {
+          Serializer serializer(BufferPool::Acquire());
 
-        serializer << funcName_;
+          SerializeRequestHeader(serializer, funcName_, funcId_, ParamsSize(IPC_CALL_FORMAT));
+
+          // Enumerate 'params' from the tuple and serialize them in 'serializer'.
+          if constexpr (TupleSize) {
+            SerializeParams<0>(serializer);
+          }
+
+          // 'ipcSync' sends 'std::vector<uint8_t>' to the server and receives 'std::vector<uint8_t>' reply.
+          auto replyFromServer = ipcSync(serializer.Bytes());
+
+          BufferPool::Release(serializer.Release());
+
+          return UnserializeReply(std::move(replyFromServer), serializer, nullptr);
+        }
+      }
+
+      // 'InStream' parameter is sent on 'channel' after the request, 'OutStream' return is received from it after the reply.
+      Ret StreamCall(const std::shared_ptr<StreamChannel>& channel) {
+        Serializer serializer(BufferPool::Acquire());
+
+        SerializeRequestHeader(serializer, funcName_, funcId_, ParamsSize(IPC_CALL_FORMAT));
 
-        // Enumerate 'params' from the tuple and serialize them in 'serializer'.
         if constexpr (TupleSize) {
           SerializeParams<0>(serializer);
         }
 
-        // 'ipcSync' sends 'std::vector<uint8_t>' to the server and receives 'std::vector<uint8_t>' reply.
-        const auto& replyFromServer = ipcSync(serializer.Bytes());
+        const auto format = serializer.GetFormat();
+        const bool compact = serializer.IsCompact();
+
+        channel->Write(FrameKind::StreamRequest, serializer.Bytes());
+
+        BufferPool::Release(serializer.Release());
+
+        auto replyFromServer = BufferPool::Acquire();
+
+        try {
+          std::apply([&](const auto&... params) { (WriteInStream(*channel, format, compact, params), ...); }, tupleWithParams_);
+        } catch (...) {
+          // The server can fail the call and close the connection before it receives the stream, then its error is thrown.
+          bool serverError = false;
+
+          try {
+            serverError = channel->Read(replyFromServer) == FrameKind::Error;
+          } catch (const std::exception&) {
+          }
+
+          if (serverError) {
+            throw std::runtime_error(std::string(replyFromServer.begin(), replyFromServer.end()));
+          }
+
+          throw;
+        }
+
+        if (channel->Read(replyFromServer) == FrameKind::Error) {
+          throw std::runtime_error(std::string(replyFromServer.begin(), replyFromServer.end()));
+        }
+
+        return UnserializeReply(std::move(replyFromServer), serializer, channel.get());
+      }
+
+      template <typename T>
+      static void WriteInStream(StreamChannel&, Format, bool, const T&) {}
+
+      template <typename T>
+      static void WriteInStream(StreamChannel& channel, Format format, bool compact, const InStream<T>& stream) {
+        stream.Write(channel, format, compact);
+      }
 
-        Unserializer unserializer(replyFromServer);
+      // Unserializes the return and 'out' 'params' from the reply of the server to 'request'.
+      Ret UnserializeReply(bytes_t&& replyFromServer, const Serializer& request, StreamChannel* channel) {
+        Unserializer unserializer(replyFromServer, request);
+        unserializer.SetChannel(channel);
 
         if constexpr (std::is_void_v<Ret>) {
           if constexpr (TupleSize) {
             UnserializeParams<TupleSize - 1>(unserializer);
           }
+
+          BufferPool::Release(std::move(replyFromServer));
         } else {
           Ret ret;
           unserializer >> ret;
@@ -57,10 +192,21 @@ namespace IpcCall {
             UnserializeParams<TupleSize - 1>(unserializer);
           }
 
+          BufferPool::Release(std::move(replyFromServer));
+
           return ret;
         }
       }
 
+      // Size of serialized 'params', it is known at compile time if all 'params' have fixed size.
+      size_t ParamsSize(Format format) const {
+        if constexpr (ParamsSerializedSize::Fixed) {
+          return ParamsSerializedSize::FixedSize;
+        } else {
+          return std::apply([format](const auto&... params) { return (SizeOf(params, format) + ... + 0); }, tupleWithParams_);
+        }
+      }
+
       // Serialize all 'params' in 'serializer'.
       template<int Index>
       void SerializeParams(Serializer& serializer) {
@@ -87,12 +233,440 @@ namespace IpcCall {
       }
 
     private:
-      std::string funcName_;
+      std::string_view funcName_;
+      func_id_t funcId_;
+      TupleWithParams tupleWithParams_;
+    };
+
+  private:
+    std::string_view funcName_;
+    func_id_t funcId_;
+  };
+
+
+  // 'IPC_CALL_FUTURE' calls 'FutureCall', it is a pipelined synchronous call that returns 'std::future'.
+  // Many calls can be in flight on one connection, the reply starts with the ID of its call, so replies can come out of order.
+  template <typename> struct FutureCall;
+
+  template <typename Ret, typename ...Params>
+  struct FutureCall<Ret(*)(Params...)> {
+    using ParamsSerializedSize = SerializedSize<std::tuple<std::decay_t<Params>...>>;
+
+    static_assert(!IsStreamingCall<Ret, Params...>(), "Streams are supported only by 'IPC_SEND_RECEIVE'");
+
+    FutureCall(std::string_view funcName, func_id_t funcId) : funcName_(funcName), funcId_(funcId) {}
+
+    // The request is serialized before the future is returned, then only references to 'out' arguments are used.
+    auto operator()(ArgRef<Params>... params) {
+      return TupleWithParamsProxy<std::tuple<ArgRef<Params>...>>(funcName_, funcId_, std::tuple<ArgRef<Params>...>(std::forward<ArgRef<Params>>(params)...));
+    }
+
+    template <typename TupleWithParams>
+    struct TupleWithParamsProxy {
+      static constexpr auto TupleSize = std::tuple_size_v<TupleWithParams>;
+
+      TupleWithParamsProxy(std::string_view funcName, func_id_t funcId, TupleWithParams&& tupleWithParams) :
+        funcName_(funcName), funcId_(funcId), tupleWithParams_(std::move(tupleWithParams)) {}
+
+      // 'ipcFuture' is the IPC transport function or function object, it is the last argument in 'IPC_CALL_FUTURE'.
+      // 'out' parameters are written when the future is ready, so they should outlive it.
+      template <typename IpcFuture>
+      std::future<Ret> operator() (IpcFuture&& ipcFuture) {
+        const call_id_t callId = NextCallId();
+
+        Serializer serializer(BufferPool::Acquire());
+
+        SerializeRequestHeader(serializer, funcName_, funcId_, ParamsSize(IPC_CALL_FORMAT), callId);
+
+        // Enumerate 'params' from the tuple and serialize them in 'serializer'.
+        std::apply([&serializer](const auto&... params) { (serializer << ... << params); }, tupleWithParams_);
+
+        // 'out' parameters are references, so the call keeps a copy of 'tupleWithParams_' until the reply.
+        auto call = std::make_shared<Call>(Call{ {}, std::move(tupleWithParams_) });
+        auto future = call->promise.get_future();
+
+        // 'ipcFuture' sends 'std::vector<uint8_t>' to the server, and calls 'completion' when the reply with 'callId' is received.
+        ipcFuture(serializer.Bytes(), callId, Completion([call, callId, format = serializer.GetFormat(), compact = serializer.IsCompact()](bytes_t&& reply, std::exception_ptr error) {
+          call->Complete(reply, error, callId, format, compact);
+
+          BufferPool::Release(std::move(reply));
+        }));
+
+        BufferPool::Release(serializer.Release());
+
+        return future;
+      }
+
+      // Size of serialized 'params', it is known at compile time if all 'params' have fixed size.
+      size_t ParamsSize(Format format) const {
+        if constexpr (ParamsSerializedSize::Fixed) {
+          return ParamsSerializedSize::FixedSize;
+        } else {
+          return std::apply([format](const auto&... params) { return (SizeOf(params, format) + ... + 0); }, tupleWithParams_);
+        }
+      }
+
+    private:
+      struct Call {
+        std::promise<Ret> promise;
+        TupleWithParams tupleWithParams;
+
+        void Complete(const bytes_t& reply, std::exception_ptr error, call_id_t callId, Format format, bool compact) {
+          try {
+            if (error) {
+              std::rethrow_exception(error);
+            }
+
+            Unserializer unserializer(reply, format);
+            unserializer.SetCompact(compact);
+
+            call_id_t replyCallId;
+            unserializer.Unserialize(replyCallId);
+
+            if (replyCallId != callId) {
+              throw std::runtime_error("IPC reply is for call " + std::to_string(replyCallId) + " instead of " + std::to_string(callId));
+            }
+
+            if constexpr (std::is_void_v<Ret>) {
+              if constexpr (TupleSize) {
+                UnserializeParams<TupleSize - 1>(unserializer);
+              }
+
+              promise.set_value();
+            } else {
+              Ret ret;
+              unserializer >> ret;
+
+              if constexpr (TupleSize) {
+                UnserializeParams<TupleSize - 1>(unserializer);
+              }
+
+              promise.set_value(std::move(ret));
+            }
+          } catch (...) {
+            promise.set_exception(std::current_exception());
+          }
+        }
+
+        // Unserialize only 'out' 'params' from 'userializer' in reversed order.
+        template<int Index>
+        void UnserializeParams(Unserializer& unserializer) {
+          if constexpr (IsOutParam<std::tuple_element_t<Index, TupleWithParams>>()) {
+            unserializer >> std::get<Index>(tupleWithParams);
+          }
+
+          if constexpr (Index > 0) {
+            UnserializeParams<Index - 1>(unserializer);
+          }
+        }
+      };
+
+      std::string_view funcName_;
+      func_id_t funcId_;
+      TupleWithParams tupleWithParams_;
+    };
+
+  private:
+    std::string_view funcName_;
+    func_id_t funcId_;
+  };
+
+
+#ifdef __cpp_lib_coroutine
+  // 'IPC_CALL_AWAIT' calls 'AwaitCall', it is a pipelined synchronous call that is awaited in a coroutine:
+  //   Ret res = co_await IPC_CALL_AWAIT(f)(args...)(ipcFuture);
+  // 'ipcFuture' is the transport of 'IPC_CALL_FUTURE', the coroutine is resumed on the thread that calls 'completion'.
+  // The awaiter is stored in the coroutine frame, so an await doesn't allocate besides the request.
+  template <typename> struct AwaitCall;
+
+  template <typename Ret, typename ...Params>
+  struct AwaitCall<Ret(*)(Params...)> {
+    using ParamsSerializedSize = SerializedSize<std::tuple<std::decay_t<Params>...>>;
+
+    static_assert(!IsStreamingCall<Ret, Params...>(), "Streams are supported only by 'IPC_SEND_RECEIVE'");
+
+    AwaitCall(std::string_view funcName, func_id_t funcId) : funcName_(funcName), funcId_(funcId) {}
+
+    // The request is serialized before the proxy is returned, with the deadline of the thread, so the proxy can be
+    // stored and awaited later, then only references to 'out' arguments are used.
+    auto operator()(ArgRef<Params>... params) {
+      return TupleWithParamsProxy<std::tuple<ArgRef<Params>...>>(funcName_, funcId_, std::tuple<ArgRef<Params>...>(std::forward<ArgRef<Params>>(params)...));
+    }
+
+    template <typename TupleWithParams>
+    struct TupleWithParamsProxy {
+      TupleWithParamsProxy(std::string_view funcName, func_id_t funcId, TupleWithParams&& tupleWithParams) :
+        tupleWithParams_(std::move(tupleWithParams)), callId_(NextCallId()), serializer_(BufferPool::Acquire()) {
+        SerializeRequestHeader(serializer_, funcName, funcId, ParamsSize(IPC_CALL_FORMAT), callId_);
+
+        std::apply([this](const auto&... params) { (serializer_ << ... << params); }, tupleWithParams_);
+      }
+
+      TupleWithParamsProxy(const TupleWithParamsProxy&) = delete;
+      TupleWithParamsProxy& operator=(const TupleWithParamsProxy&) = delete;
+
+      ~TupleWithParamsProxy() {
+        BufferPool::Release(serializer_.Release());
+      }
+
+      // 'ipcFuture' is the IPC transport function or function object, it is the last argument in 'IPC_CALL_AWAIT'.
+      template <typename IpcFuture>
+      auto operator() (IpcFuture&& ipcFuture) {
+        return Awaiter<TupleWithParams, std::decay_t<IpcFuture>>(std::move(tupleWithParams_), callId_, std::move(serializer_), std::forward<IpcFuture>(ipcFuture));
+      }
+
+    private:
+      // Size of serialized 'params', it is known at compile time if all 'params' have fixed size.
+      size_t ParamsSize(Format format) const {
+        if constexpr (ParamsSerializedSize::Fixed) {
+          return ParamsSerializedSize::FixedSize;
+        } else {
+          return std::apply([format](const auto&... params) { return (SizeOf(params, format) + ... + 0); }, tupleWithParams_);
+        }
+      }
+
+      TupleWithParams tupleWithParams_;
+      call_id_t callId_;
+      Serializer serializer_;
+    };
+
+    template <typename TupleWithParams, typename IpcFuture>
+    struct Awaiter {
+      static constexpr auto TupleSize = std::tuple_size_v<TupleWithParams>;
+
+      Awaiter(TupleWithParams&& tupleWithParams, call_id_t callId, Serializer&& serializer, IpcFuture ipcFuture) :
+        tupleWithParams_(std::move(tupleWithParams)), ipcFuture_(std::move(ipcFuture)), callId_(callId),
+        format_(serializer.GetFormat()), compact_(serializer.IsCompact()), request_(serializer.Release()) {}
+
+      Awaiter(const Awaiter&) = delete;
+      Awaiter& operator=(const Awaiter&) = delete;
+
+      ~Awaiter() {
+        BufferPool::Release(std::move(request_));
+      }
+
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      // Sends the request. Returns false if the reply is already received, then the coroutine is not suspended.
+      bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+
+        // 'completion' captures only 'this', so 'std::function' doesn't allocate.
+        ipcFuture_(request_, callId_, Completion([this](bytes_t&& reply, std::exception_ptr error) {
+          reply_ = std::move(reply);
+          error_ = error;
+
+          // The second of 'completion' and 'await_suspend' resumes the coroutine.
+          if (completed_.exchange(true)) {
+            handle_.resume();
+          }
+        }));
+
+        return !completed_.exchange(true);
+      }
+
+      // Unserializes the return and 'out' parameters, or throws the exception of the call.
+      Ret await_resume() {
+        if (error_) {
+          std::rethrow_exception(error_);
+        }
+
+        Unserializer unserializer(reply_, format_);
+        unserializer.SetCompact(compact_);
+
+        call_id_t replyCallId;
+        unserializer.Unserialize(replyCallId);
+
+        if (replyCallId != callId_) {
+          throw std::runtime_error("IPC reply is for call " + std::to_string(replyCallId) + " instead of " + std::to_string(callId_));
+        }
+
+        if constexpr (std::is_void_v<Ret>) {
+          if constexpr (TupleSize) {
+            UnserializeParams<TupleSize - 1>(unserializer);
+          }
+
+          BufferPool::Release(std::move(reply_));
+        } else {
+          Ret ret;
+          unserializer >> ret;
+
+          if constexpr (TupleSize) {
+            UnserializeParams<TupleSize - 1>(unserializer);
+          }
+
+          BufferPool::Release(std::move(reply_));
+
+          return ret;
+        }
+      }
+
+    private:
+      // Unserialize only 'out' 'params' from 'userializer' in reversed order.
+      template<int Index>
+      void UnserializeParams(Unserializer& unserializer) {
+        if constexpr (IsOutParam<std::tuple_element_t<Index, TupleWithParams>>()) {
+          unserializer >> std::get<Index>(tupleWithParams_);
+        }
+
+        if constexpr (Index > 0) {
+          UnserializeParams<Index - 1>(unserializer);
+        }
+      }
+
       TupleWithParams tupleWithParams_;
+      IpcFuture ipcFuture_;
+
+      std::coroutine_handle<> handle_;
+      const call_id_t callId_;
+      const Format format_;
+      const bool compact_;
+
+      bytes_t request_;
+      bytes_t reply_;
+      std::exception_ptr error_;
+      std::atomic<bool> completed_ = false;
     };
 
   private:
-    std::string funcName_;
+    std::string_view funcName_;
+    func_id_t funcId_;
+  };
+#endif
+
+  // Calls that are sent to the server in one message, they are executed by 'Server::BatchCall'.
+  //   IpcCall::Batch batch;
+  //   IPC_SEND(f)(args...)(batch.Async());
+  //   auto res = IPC_CALL_FUTURE(g)(args...)(batch.Future());
+  //   batch.Send(IpcSync); // 'res' is ready.
+  // A batch of only asynchronous calls can be sent with 'batch.Post(IpcAsync)'.
+  struct Batch {
+    Batch() {
+      Clear();
+    }
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    ~Batch() {
+      BufferPool::Release(serializer_.Release());
+    }
+
+    // Transport for 'IPC_SEND'.
+    auto Async() {
+      return [this](const bytes_t& bytes) { serializer_ << false << bytes; };
+    }
+
+    // Transport for 'IPC_CALL_FUTURE', the future is ready after 'Send'.
+    auto Future() {
+      return [this](const bytes_t& bytes, call_id_t, Completion completion) {
+        serializer_ << true << bytes;
+        completions_.push_back(std::move(completion));
+      };
+    }
+
+    bool Empty() const {
+      return serializer_.Bytes().size() == emptySize_;
+    }
+
+    // Sends the calls with the synchronous IPC transport 'ipcSync' and completes the futures.
+    // If 'ipcSync' throws, the futures get its exception and it is rethrown.
+    template <typename IpcSync>
+    void Send(IpcSync&& ipcSync) {
+      if (Empty()) {
+        return;
+      }
+
+      auto completions = std::move(completions_);
+      const auto format = serializer_.GetFormat();
+      const bool compact = serializer_.IsCompact();
+
+      bytes_t replyFromServer;
+
+      try {
+        replyFromServer = ipcSync(serializer_.Bytes());
+      } catch (...) {
+        Clear();
+
+        for (auto& completion : completions) {
+          completion({}, std::current_exception());
+        }
+
+        throw;
+      }
+
+      Clear();
+
+      Unserializer unserializer(replyFromServer, format);
+      unserializer.SetCompact(compact);
+
+      for (auto& completion : completions) {
+        bytes_t reply = BufferPool::Acquire();
+        std::exception_ptr error;
+
+        try {
+          bool failed;
+          unserializer >> failed;
+
+          if (failed) {
+            std::string what;
+            unserializer >> what;
+
+            error = std::make_exception_ptr(std::runtime_error(what));
+          } else {
+            unserializer >> reply;
+          }
+        } catch (...) {
+          error = std::current_exception();
+        }
+
+        completion(std::move(reply), error);
+      }
+
+      BufferPool::Release(std::move(replyFromServer));
+    }
+
+    // Sends the asynchronous calls with the asynchronous IPC transport 'ipcAsync'.
+    template <typename IpcAsync>
+    void Post(IpcAsync&& ipcAsync) {
+      if (!completions_.empty()) {
+        throw std::logic_error("IPC batch with synchronous calls should be sent with 'Send'");
+      }
+
+      if (Empty()) {
+        return;
+      }
+
+      ipcAsync(serializer_.Bytes());
+
+      Clear();
+    }
+
+  private:
+    void Clear() {
+      BufferPool::Release(serializer_.Release());
+      serializer_ = Serializer(BufferPool::Acquire());
+
+      Header header{ IPC_CALL_FORMAT, IsBatch };
+      if (header.format < Format::Flags) {
+        throw std::logic_error("IPC batch requires 'IpcCall::Format::Flags'");
+      }
+
+      if (IPC_CALL_COMPACT) {
+        header.flags |= Compact;
+      }
+
+      serializer_ << header;
+      emptySize_ = serializer_.Bytes().size();
+
+      completions_.clear();
+    }
+
+    Serializer serializer_;
+    size_t emptySize_ = 0;
+    std::vector<Completion> completions_;
   };
 
 
@@ -101,30 +675,29 @@ namespace IpcCall {
 
   template <typename ...Params>
   struct AsyncCall<void(*)(Params...)> {
-    AsyncCall(const std::string& funcName) : funcName_(funcName) {}
+    using ParamsSerializedSize = SerializedSize<std::tuple<std::decay_t<Params>...>>;
 
-    auto operator()(Params... params) {
-      if constexpr (0 == sizeof...(Params)) {
-        return TupleWithParamsProxy<decltype(std::tuple<>())>(funcName_, std::tuple<>());
-      } else {
-        const auto tupleWithParams = std::tuple<Params...>(std::forward<Params>(params)...);
+    static_assert(!IsStreamingCall<void, Params...>(), "Streams are supported only by 'IPC_SEND_RECEIVE'");
 
-        return TupleWithParamsProxy<decltype(tupleWithParams)>(funcName_, tupleWithParams);
-      }
+    AsyncCall(std::string_view funcName, func_id_t funcId) : funcName_(funcName), funcId_(funcId) {}
+
+    auto operator()(ArgRef<Params>... params) {
+      return TupleWithParamsProxy<std::tuple<ArgRef<Params>...>>(funcName_, funcId_, std::tuple<ArgRef<Params>...>(std::forward<ArgRef<Params>>(params)...));
     }
 
     template <typename TupleWithParams>
     struct TupleWithParamsProxy {
       static constexpr auto TupleSize = std::tuple_size_v<TupleWithParams>;
 
-      TupleWithParamsProxy(const std::string& funcName, const TupleWithParams& tupleWithParams) :
-        funcName_(funcName), tupleWithParams_(tupleWithParams) {}
+      TupleWithParamsProxy(std::string_view funcName, func_id_t funcId, TupleWithParams&& tupleWithParams) :
+        funcName_(funcName), funcId_(funcId), tupleWithParams_(std::move(tupleWithParams)) {}
 
-      // 'ipcAsync' is a pointer to the IPC transport function, it is the last argument in 'IPC_ASYNC_CALL'.
-      void operator() (void(ipcAsync)(const std::vector<uint8_t>&)) {
-        Serializer serializer;
+      // 'ipcAsync' is the IPC transport function or function object, it is the last argument in 'IPC_SEND'.
+      template <typename IpcAsync>
+      void operator() (IpcAsync&& ipcAsync) {
+        Serializer serializer(BufferPool::Acquire());
 
-        serializer << funcName_;
+        SerializeRequestHeader(serializer, funcName_, funcId_, ParamsSize(IPC_CALL_FORMAT));
 
         // Enumerate 'params' from the tuple and serialize them in 'serializer'.
         if constexpr (TupleSize) {
@@ -133,6 +706,17 @@ namespace IpcCall {
 
         // 'ipcAsync' sends 'std::vector<uint8_t>' to the server.
         ipcAsync(serializer.Bytes());
+
+        BufferPool::Release(serializer.Release());
+      }
+
+      // Size of serialized 'params', it is known at compile time if all 'params' have fixed size.
+      size_t ParamsSize(Format format) const {
+        if constexpr (ParamsSerializedSize::Fixed) {
+          return ParamsSerializedSize::FixedSize;
+        } else {
+          return std::apply([format](const auto&... params) { return (SizeOf(params, format) + ... + 0); }, tupleWithParams_);
+        }
       }
 
       // Serialize all 'params' in 'serializer'.
@@ -150,15 +734,24 @@ namespace IpcCall {
       }
 
     private:
-      std::string funcName_;
+      std::string_view funcName_;
+      func_id_t funcId_;
       TupleWithParams tupleWithParams_;
     };
 
   private:
-    std::string funcName_;
+    std::string_view funcName_;
+    func_id_t funcId_;
   };
 
 }
 
-#define IPC_SEND_RECEIVE(x) IpcCall::SyncCall<decltype(&x)>(#x)
-#define IPC_SEND(x) IpcCall::AsyncCall<decltype(&x)>(#x)
+#define IPC_FUNCTION_ID(x) std::integral_constant<IpcCall::func_id_t, IpcCall::FunctionId(#x)>::value
+
+#define IPC_SEND_RECEIVE(x) IpcCall::SyncCall<decltype(&x)>(#x, IPC_FUNCTION_ID(x))
+#define IPC_SEND(x) IpcCall::AsyncCall<decltype(&x)>(#x, IPC_FUNCTION_ID(x))
+#define IPC_CALL_FUTURE(x) IpcCall::FutureCall<decltype(&x)>(#x, IPC_FUNCTION_ID(x))
+
+#ifdef __cpp_lib_coroutine
+#define IPC_CALL_AWAIT(x) IpcCall::AwaitCall<decltype(&x)>(#x, IPC_FUNCTION_ID(x))
+#endif
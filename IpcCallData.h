@@ -12,23 +12,443 @@
 #include <unordered_map>
 #include <stack>
 #include <queue>
+#include <array>
 #include <memory>
 #include <algorithm>
 #include <iterator>
+#include <limits>
 #include <string>
+#include <string_view>
 #include <sstream> 
+#include <cstddef>
 #include <cstring>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+
+#if __has_include(<version>)
+#include <version>
+#endif
+
+#ifdef __cpp_lib_span
+#include <span>
+#endif
 
 namespace IpcCall {
     using bytes_t = std::vector<uint8_t>;
 
+    // Types that are serialized as raw bytes, and containers of them with a single 'memcpy'.
+    // Arithmetic types and enums are trivially serializable, a trivially copyable custom struct can opt in:
+    //   template <> struct IpcCall::TriviallySerializable<Point>: std::true_type {};
+    template <typename T>
+    struct TriviallySerializable: std::bool_constant<std::is_arithmetic_v<T> || std::is_enum_v<T>> {};
+
+    template <typename T, size_t N>
+    struct TriviallySerializable<std::array<T, N>>: TriviallySerializable<T> {};
+
+    template <typename T>
+    static constexpr bool IsTriviallySerializable() {
+        static_assert(!TriviallySerializable<T>::value || std::is_trivially_copyable_v<T>, "Only trivially copyable type can be serialized as raw bytes");
+
+        return TriviallySerializable<T>::value;
+    }
+
+    // Sequence containers that store elements contiguously.
+    template <typename T>
+    struct Contiguous: std::false_type {};
+
+    template <typename T, typename A>
+    struct Contiguous<std::vector<T, A>>: std::bool_constant<!std::is_same_v<T, bool>> {};
+
+    template <typename C, typename Traits, typename A>
+    struct Contiguous<std::basic_string<C, Traits, A>>: std::true_type {};
+
+    // Containers with 'reserve'.
+    template <typename T, typename = void>
+    struct Reservable: std::false_type {};
+
+    template <typename T>
+    struct Reservable<T, std::void_t<decltype(std::declval<T&>().reserve(size_t()))>>: std::true_type {};
+
+    // Underlying container of 'std::stack', 'std::queue' and 'std::priority_queue'.
+    template <typename T>
+    const typename T::container_type& UnderlyingContainer(const T& adapter) {
+        struct Access: T {
+            static const typename T::container_type& Container(const T& adapter) {
+                return adapter.*(&Access::c);
+            }
+        };
+
+        return Access::Container(adapter);
+    }
+
+    template <typename T>
+    typename T::container_type& UnderlyingContainer(T& adapter) {
+        struct Access: T {
+            static typename T::container_type& Container(T& adapter) {
+                return adapter.*(&Access::c);
+            }
+        };
+
+        return Access::Container(adapter);
+    }
+
+    // Restores the heap order of the underlying container of 'std::priority_queue' in O(n), the data is not trusted.
+    template <typename T>
+    void MakeHeap(T& adapter) {
+        struct Access: T {
+            static void MakeHeap(T& adapter) {
+                auto& c = adapter.*(&Access::c);
+                std::make_heap(c.begin(), c.end(), adapter.*(&Access::comp));
+            }
+        };
+
+        Access::MakeHeap(adapter);
+    }
+
+    // Integral types that are varints in the compact encoding, 1-byte types are not.
+    template <typename T>
+    static constexpr bool IsVarint() {
+        return std::is_integral_v<T> && sizeof(T) > 1;
+    }
+
+    // Fields of a custom struct in the order they are serialized, it is specialized by 'IPC_SERIALIZABLE'.
+    template <typename T>
+    struct Fields {
+        static constexpr bool Declared = false;
+    };
+
+    template <typename M>
+    struct FieldType;
+
+    template <typename C, typename M>
+    struct FieldType<M C::*> {
+        using type = M;
+    };
+
+    // Types that have varints in the compact encoding, including fields of 'IPC_SERIALIZABLE' structs.
+    template <typename T>
+    static constexpr bool HasVarint();
+
+    // Layout of the serialized fields of 'IPC_SERIALIZABLE' struct 'T'.
+    template <typename T, typename = std::make_index_sequence<std::tuple_size_v<std::remove_const_t<decltype(Fields<T>::Members)>>>>
+    struct FieldsLayout;
+
+    template <typename T, size_t ...I>
+    struct FieldsLayout<T, std::index_sequence<I...>> {
+        template <size_t J>
+        using type = typename FieldType<std::tuple_element_t<J, std::remove_const_t<decltype(Fields<T>::Members)>>>::type;
+
+        // Every field is raw bytes, they are serialized at fixed offsets in 'Size' bytes.
+        static constexpr bool Raw = (IsTriviallySerializable<type<I>>() && ...);
+        static constexpr size_t Size = (sizeof(type<I>) + ... + 0);
+
+        static constexpr bool Varint = (HasVarint<type<I>>() || ...);
+
+        template <size_t J>
+        static constexpr size_t Offset() {
+            return (0 + ... + (I < J ? sizeof(type<I>) : 0));
+        }
+
+        // The layout in memory is the serialized layout, so the struct and arrays of it are copied as a whole.
+        static constexpr bool Packed() {
+            if constexpr (Raw && std::is_trivially_copyable_v<T> && std::is_standard_layout_v<T>) {
+                constexpr auto offsets = Fields<T>::template Offsets<T>();
+                return Size == sizeof(T) && ((offsets[I] == Offset<I>()) && ...);
+            } else {
+                return false;
+            }
+        }
+    };
+
+    template <typename T>
+    static constexpr bool HasVarint() {
+        if constexpr (Fields<T>::Declared) {
+            return FieldsLayout<T>::Varint;
+        } else {
+            return IsVarint<T>();
+        }
+    }
+
+    template <typename T>
+    static constexpr bool IsRawStruct() {
+        if constexpr (Fields<T>::Declared) {
+            return FieldsLayout<T>::Raw;
+        } else {
+            return false;
+        }
+    }
+
+    template <typename T>
+    static constexpr bool IsPackedStruct() {
+        if constexpr (Fields<T>::Declared) {
+            return FieldsLayout<T>::Packed();
+        } else {
+            return false;
+        }
+    }
+
+    template <typename T>
+    static constexpr bool IsBulkSequence() {
+        return Contiguous<T>::value && (IsTriviallySerializable<typename T::value_type>() || IsPackedStruct<typename T::value_type>());
+    }
+
+    // Wire format of a message.
+    enum class Format: uint8_t {
+        Legacy = 0,         // Null-terminated strings, the request has no 'Header'.
+        LengthPrefixed = 1, // Strings are prefixed with their length.
+        Flags = 2,          // Same as 'LengthPrefixed', 'Header' has 'flags'.
+        Latest = Flags
+    };
+
+    // 'Header::flags' bits.
+    enum HeaderFlags: uint8_t {
+        HasFunctionId = 1 << 0, // The function is identified by 'FunctionId' of its name instead of the name.
+        HasCallId = 1 << 1,     // The call is pipelined, 'Header' has 'callId' and the reply starts with it.
+        IsBatch = 1 << 2,       // The request is a batch of requests, see 'Server::BatchCall'.
+        Compact = 1 << 3,       // Integers and lengths are varints in the request and the reply, see 'Serializer::WriteVarint'.
+        HasDeadline = 1 << 4,   // 'Header' has 'deadline' of the call, see 'Deadline'.
+    };
+
+    // ID of a pipelined call, it matches the reply with the call when many calls are in flight.
+    using call_id_t = uint64_t;
+
+    // Header of a request. A 'Legacy' request has no header and starts with the function name,
+    // which cannot start with 'Magic', so the server accepts both.
+    struct Header {
+        static constexpr uint8_t Magic = 0xFF;
+
+        Format format = Format::Legacy;
+        uint8_t flags = 0;
+        call_id_t callId = 0;  // If 'flags' has 'HasCallId'.
+        uint64_t deadline = 0; // If 'flags' has 'HasDeadline', nanoseconds that are left until the deadline when it is sent.
+    };
+
+    // Error of a call after its deadline.
+    struct DeadlineExceeded: std::runtime_error {
+        DeadlineExceeded() : std::runtime_error("IPC call deadline is exceeded") {}
+    };
+
+    // Deadline of the IPC calls of the current thread, a request carries it in 'Header::deadline'.
+    //   {
+    //     IpcCall::Deadline deadline(std::chrono::milliseconds(100));
+    //     auto res = IPC_SEND_RECEIVE(f)(args...)(ipcSync);
+    //   }
+    // A call after the deadline throws 'DeadlineExceeded' and it is not sent. The server drops an expired request before
+    // it unserializes the parameters and before it serializes the reply, a synchronous call fails with 'DeadlineExceeded'.
+    // A function is executed in the scope of the deadline of its request, so its IPC calls have the same deadline.
+    // A nested scope can only make the deadline earlier. The request carries the time that is left, the server adds it
+    // to the time when it receives the request, so the clocks of the client and the server are not compared.
+    class Deadline {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit Deadline(Clock::duration timeout) : Deadline(Clock::now() + timeout) {}
+
+        explicit Deadline(Clock::time_point deadline) : previous_(Current()) {
+            const auto ns = Nanoseconds(deadline);
+
+            if (previous_ == 0 || ns < previous_) {
+                Current() = std::max<uint64_t>(ns, 1);
+            }
+        }
+
+        Deadline(const Deadline&) = delete;
+        Deadline& operator=(const Deadline&) = delete;
+
+        ~Deadline() {
+            Current() = previous_;
+        }
+
+        // 'Clock' nanoseconds of the deadline of the current thread, 0 if there is no deadline.
+        static uint64_t& Current() {
+            static thread_local uint64_t s_deadline = 0;
+            return s_deadline;
+        }
+
+        static bool Expired(uint64_t deadline) {
+            return deadline != 0 && Nanoseconds(Clock::now()) >= deadline;
+        }
+
+        // Nanoseconds that are left until 'deadline', 0 if it is expired.
+        static uint64_t Remaining(uint64_t deadline) {
+            const uint64_t now = Nanoseconds(Clock::now());
+            return deadline > now ? deadline - now : 0;
+        }
+
+        static uint64_t Nanoseconds(Clock::time_point time) {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+        }
+
+    private:
+        uint64_t previous_;
+    };
+
+    // Function ID is FNV-1a hash of the function name, it is calculated at compile time by the client.
+    using func_id_t = uint32_t;
+
+    constexpr func_id_t FunctionId(std::string_view funcName) {
+        func_id_t hash = 2166136261u;
+
+        for (auto c : funcName) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+        }
+
+        return hash;
+    }
+
+    // Thread-local pool of message buffers, a released buffer keeps its capacity for the next message.
+    struct BufferPool {
+        static constexpr size_t MaxBuffers = 16;
+        static constexpr size_t MaxCapacity = 1 << 20;
+
+        // Returns an empty buffer, with capacity if it was used before.
+        static bytes_t Acquire() {
+            auto& buffers = Buffers();
+            if (buffers.empty()) {
+                return {};
+            }
+
+            auto bytes = std::move(buffers.back());
+            buffers.pop_back();
+
+            return bytes;
+        }
+
+        // Returns 'bytes' to the pool, large buffers are freed.
+        static void Release(bytes_t&& bytes) {
+            auto& buffers = Buffers();
+            if (buffers.size() == MaxBuffers || bytes.capacity() == 0 || bytes.capacity() > MaxCapacity) {
+                return;
+            }
+
+            bytes.clear();
+            buffers.push_back(std::move(bytes));
+        }
+
+    private:
+        static std::vector<bytes_t>& Buffers() {
+            static thread_local std::vector<bytes_t> s_buffers;
+            return s_buffers;
+        }
+    };
+
+    // Connection of a streaming call, see 'IpcCallStream.h'.
+    struct StreamChannel;
+
+    // Called with the reply of a call, or the exception of the server or of the transport.
+    using Completion = std::function<void(bytes_t&& reply, std::exception_ptr error)>;
+
+    // ID of the pipelined call that 'reply' is for.
+    inline call_id_t ReplyCallId(const bytes_t& reply) {
+        if (reply.size() < sizeof(call_id_t)) {
+            throw std::runtime_error("IPC data is truncated");
+        }
+
+        call_id_t callId;
+        memcpy(&callId, reply.data(), sizeof(callId));
+
+        return callId;
+    }
+
     struct Serializer {
-        Serializer() { }
+        Serializer(Format format = Format::Legacy) : format_(format) { }
+
+        // Serializes into 'bytes', reusing its capacity (e.g. 'BufferPool::Acquire()').
+        Serializer(bytes_t&& bytes, Format format = Format::Legacy) : bytes_(std::move(bytes)), format_(format) {
+            bytes_.clear();
+        }
+
+        Format GetFormat() const {
+            return format_;
+        }
+
+        void SetFormat(Format format) {
+            format_ = format;
+        }
 
         template <typename T>
         void Serialize(const T& t) {
-            std::copy((char*)&t, (char*)&t + sizeof(T), back_inserter(bytes_));
+            Write(&t, sizeof(T));
+        }
+
+        void Write(const void* data, size_t size) {
+            const auto begin = static_cast<const uint8_t*>(data);
+
+            bytes_.insert(bytes_.end(), begin, begin + size);
+        }
+
+        // Compact encoding, it is set by the 'Header' with 'Compact' flag.
+        bool IsCompact() const {
+            return compact_;
+        }
+
+        void SetCompact(bool compact) {
+            compact_ = compact;
+        }
+
+        // LEB128, 7 bits in every byte, the high bit is set if more bytes follow.
+        void WriteVarint(uint64_t value) {
+            // Common case, a value below 128 is one byte.
+            if (value < 0x80) {
+                bytes_.push_back(static_cast<uint8_t>(value));
+                return;
+            }
+
+            do {
+                bytes_.push_back(static_cast<uint8_t>(value) | 0x80);
+                value >>= 7;
+            } while (value >= 0x80);
+
+            bytes_.push_back(static_cast<uint8_t>(value));
+        }
+
+        // Signed values are zigzag encoded, so small negative values are small varints.
+        template <typename T>
+        void WriteInteger(T value) {
+            if constexpr (std::is_signed_v<T>) {
+                const auto v = static_cast<int64_t>(value);
+                WriteVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+            } else {
+                WriteVarint(value);
+            }
+        }
+
+        // Reserves 'size' more bytes, so the following 'size' bytes are written without reallocation.
+        void Reserve(size_t size) {
+            bytes_.reserve(bytes_.size() + size);
+        }
+
+        // Pads with zeros to a multiple of 'alignment' from the beginning of the message.
+        void Align(size_t alignment) {
+            bytes_.resize((bytes_.size() + alignment - 1) / alignment * alignment);
+        }
+
+        // Struct declared by 'IPC_SERIALIZABLE', its fields are serialized in the declared order.
+        // Raw fields are copied at offsets that are known at compile time, a packed struct is copied as a whole.
+        template <typename T>
+        Serializer& Struct(const T& arg) {
+            using layout = FieldsLayout<T>;
+
+            if constexpr (layout::Raw) {
+                if (!compact_ || !layout::Varint) {
+                    if constexpr (layout::Packed()) {
+                        Write(&arg, sizeof(T));
+                    } else {
+                        const size_t start = bytes_.size();
+                        bytes_.resize(start + layout::Size);
+
+                        WriteFields(arg, bytes_.data() + start, std::make_index_sequence<std::tuple_size_v<std::remove_const_t<decltype(Fields<T>::Members)>>>());
+                    }
+
+                    return *this;
+                }
+            }
+
+            return std::apply([&](auto... member) -> Serializer& { return (*this << ... << (arg.*member)); }, Fields<T>::Members);
         }
 
         template <typename T>
@@ -37,6 +457,32 @@ namespace IpcCall {
 
             serializer << arg.size();
 
+            // In the compact encoding integral elements are varints.
+            if constexpr (IsBulkSequence<T>()) {
+                if (!compact_ || !HasVarint<typename T::value_type>()) {
+                    Write(arg.data(), arg.size() * sizeof(typename T::value_type));
+                    return serializer;
+                }
+
+                Reserve(arg.size());
+            } else if constexpr (IsRawStruct<typename T::value_type>()) {
+                if (!compact_ || !HasVarint<typename T::value_type>()) {
+                    using type = typename T::value_type;
+                    using layout = FieldsLayout<type>;
+
+                    // The buffer grows once, then fields of every element are copied at their offsets.
+                    size_t offset = bytes_.size();
+                    bytes_.resize(offset + arg.size() * layout::Size);
+
+                    for (const auto& el : arg) {
+                        WriteFields(el, bytes_.data() + offset, std::make_index_sequence<std::tuple_size_v<std::remove_const_t<decltype(Fields<type>::Members)>>>());
+                        offset += layout::Size;
+                    }
+
+                    return serializer;
+                }
+            }
+
             for (const auto& el : arg) {
                 serializer << el;
             }
@@ -44,6 +490,7 @@ namespace IpcCall {
             return serializer;
         }
 
+        // set, unordered_set, multiset, unordered_multiset
         template <typename T>
         Serializer& Set(const T& arg) {
             Serializer& serializer = *this;
@@ -58,8 +505,9 @@ namespace IpcCall {
             return serializer;
         }
 
-        template<typename TKey, typename TValue>
-        Serializer& Map(const std::map<TKey, TValue>& arg) {
+        // map, unordered_map, multimap, unordered_multimap
+        template<typename T>
+        Serializer& Map(const T& arg) {
             Serializer& serializer = *this;
 
             serializer << arg.size();
@@ -71,30 +519,23 @@ namespace IpcCall {
             return serializer;
         }
 
+        // stack, queue, priority_queue, the underlying container is serialized in storage order.
         template<typename T>
         Serializer& ContainerAdapter(const T& arg) {
-            Serializer& serializer = *this;
-
-            auto tmp = arg;
-
-            serializer << arg.size();
-
-            while (!tmp.empty()) {
-                serializer << tmp.top();
-                tmp.pop();
-            }
-
-            return serializer;
+            return *this << UnderlyingContainer(arg);
         }
 
         template <typename T>
         Serializer& String(const T& arg) {
             Serializer& serializer = *this;
 
-            for (auto c : arg) {
-                serializer.Serialize(c);
+            if (format_ == Format::Legacy) {
+                serializer.Write(arg.data(), arg.size() * sizeof(typename T::value_type));
+                serializer.Serialize(typename T::value_type{});
+            } else {
+                serializer << arg.size();
+                serializer.Write(arg.data(), arg.size() * sizeof(typename T::value_type));
             }
-            serializer.Serialize(std::remove_reference_t<decltype(arg[0])>{});
 
             return serializer;
         }
@@ -103,18 +544,207 @@ namespace IpcCall {
             return bytes_;
         }
 
+        // Moves out the serialized bytes.
+        bytes_t Release() {
+            return std::move(bytes_);
+        }
+
+        // Channel of a streaming call, 'OutStream' is sent on it after the reply.
+        StreamChannel* GetChannel() const {
+            return channel_;
+        }
+
+        void SetChannel(StreamChannel* channel) {
+            channel_ = channel;
+        }
+
     private:
+        template <typename T, size_t ...I>
+        static void WriteFields(const T& arg, uint8_t* data, std::index_sequence<I...>) {
+            using layout = FieldsLayout<T>;
+
+            (memcpy(data + layout::template Offset<I>(), &(arg.*std::get<I>(Fields<T>::Members)), sizeof(typename layout::template type<I>)), ...);
+        }
+
         bytes_t bytes_;
+        Format format_;
+        bool compact_ = false;
+        StreamChannel* channel_ = nullptr;
     };
 
     struct Unserializer {
-        Unserializer(const bytes_t& bytes) : bytes_(bytes) {}
+        Unserializer(const bytes_t& bytes, Format format = Format::Legacy) : bytes_(bytes), format_(format) {}
+
+        // Unserializer of the reply to 'request', it has the format and the encoding of the request.
+        Unserializer(const bytes_t& bytes, const Serializer& request) : bytes_(bytes), format_(request.GetFormat()), compact_(request.IsCompact()) {}
+
+        Format GetFormat() const {
+            return format_;
+        }
+
+        void SetFormat(Format format) {
+            format_ = format;
+        }
+
+        // Channel of a streaming call, 'InStream' and 'OutStream' are received from it.
+        StreamChannel* GetChannel() const {
+            return channel_;
+        }
+
+        void SetChannel(StreamChannel* channel) {
+            channel_ = channel;
+        }
+
+        // Next byte, or 0 if there is no more data.
+        uint8_t Peek() const {
+            return Available() ? bytes_[index_] : 0;
+        }
 
         template <typename T>
         void Unserialize(T& t) {
-            memcpy((void*)&t, &bytes_[index_], sizeof(T));
+            Read(&t, sizeof(T));
+        }
+
+        void Read(void* data, size_t size) {
+            if (size > Available()) {
+                throw std::runtime_error("IPC data is truncated");
+            }
+
+            if (size) {
+                memcpy(data, bytes_.data() + index_, size);
+            }
+
+            index_ += size;
+        }
+
+        size_t Available() const {
+            return bytes_.size() - index_;
+        }
+
+        // Bytes that are not unserialized yet, there are 'Available' of them.
+        const uint8_t* Data() const {
+            return bytes_.data() + index_;
+        }
+
+        // Offset of 'Data' from the beginning of the message, 'Align' pads relative to it.
+        size_t Offset() const {
+            return index_;
+        }
+
+        bool IsCompact() const {
+            return compact_;
+        }
+
+        void SetCompact(bool compact) {
+            compact_ = compact;
+        }
+
+        // See 'Serializer::WriteVarint'.
+        uint64_t ReadVarint() {
+            // Common case, a value below 128 is one byte.
+            if (index_ < bytes_.size() && bytes_[index_] < 0x80) {
+                return bytes_[index_++];
+            }
+
+            uint64_t value = 0;
 
-            index_ += sizeof(T);
+            for (unsigned shift = 0; shift < 64; shift += 7) {
+                if (index_ == bytes_.size()) {
+                    throw std::runtime_error("IPC data is truncated");
+                }
+
+                const uint8_t byte = bytes_[index_++];
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+                if (byte < 0x80) {
+                    return value;
+                }
+            }
+
+            throw std::runtime_error("IPC varint is too long");
+        }
+
+        // Size of a container or a string, it is a varint in the compact encoding.
+        void UnserializeSize(size_t& size) {
+            if (compact_) {
+                ReadInteger(size);
+            } else {
+                Unserialize(size);
+            }
+        }
+
+        template <typename T>
+        void ReadInteger(T& value) {
+            const uint64_t v = ReadVarint();
+
+            if constexpr (std::is_signed_v<T>) {
+                const auto n = static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1));
+
+                if (n < static_cast<int64_t>(std::numeric_limits<T>::min()) || n > static_cast<int64_t>(std::numeric_limits<T>::max())) {
+                    throw std::runtime_error("IPC integer is out of range");
+                }
+
+                value = static_cast<T>(n);
+            } else {
+                if (v > static_cast<uint64_t>(std::numeric_limits<T>::max())) {
+                    throw std::runtime_error("IPC integer is out of range");
+                }
+
+                value = static_cast<T>(v);
+            }
+        }
+
+        // Skips the padding written by 'Serializer::Align'.
+        void Align(size_t alignment) {
+            const size_t index = (index_ + alignment - 1) / alignment * alignment;
+            if (index > bytes_.size()) {
+                throw std::runtime_error("IPC data is truncated");
+            }
+
+            index_ = index;
+        }
+
+        // Returns a pointer to the next 'count' elements of 'T' in the data, without copying them.
+        template <typename T>
+        const T* View(size_t count) {
+            if (count > Available() / sizeof(T)) {
+                throw std::runtime_error("IPC data is truncated");
+            }
+
+            const auto data = bytes_.data() + index_;
+            if (reinterpret_cast<uintptr_t>(data) % alignof(T)) {
+                throw std::runtime_error("IPC data is misaligned");
+            }
+
+            index_ += count * sizeof(T);
+
+            return reinterpret_cast<const T*>(data);
+        }
+
+        // See 'Serializer::Struct'.
+        template <typename T>
+        Unserializer& Struct(T& arg) {
+            using layout = FieldsLayout<T>;
+
+            if constexpr (layout::Raw) {
+                if (!compact_ || !layout::Varint) {
+                    if constexpr (layout::Packed()) {
+                        Read(&arg, sizeof(T));
+                    } else {
+                        if (layout::Size > Available()) {
+                            throw std::runtime_error("IPC data is truncated");
+                        }
+
+                        ReadFields(arg, bytes_.data() + index_, std::make_index_sequence<std::tuple_size_v<std::remove_const_t<decltype(Fields<T>::Members)>>>());
+
+                        index_ += layout::Size;
+                    }
+
+                    return *this;
+                }
+            }
+
+            return std::apply([&](auto... member) -> Unserializer& { return (*this >> ... >> (arg.*member)); }, Fields<T>::Members);
         }
 
         template <typename T>
@@ -124,21 +754,76 @@ namespace IpcCall {
             arg.clear();
 
             size_t size;
-            unserializer.Unserialize(size);
+            unserializer.UnserializeSize(size);
 
             using type = typename T::value_type; //std::remove_reference_t<decltype(arg[0])>;
 
+            // In the compact encoding integral elements are varints, at least 1 byte each.
+            if constexpr (IsBulkSequence<T>()) {
+                if (!compact_ || !HasVarint<type>()) {
+                    if (size > Available() / sizeof(type)) {
+                        throw std::runtime_error("IPC data is truncated");
+                    }
+
+                    arg.resize(size);
+                    Read(arg.data(), size * sizeof(type));
+
+                    return unserializer;
+                }
+
+                if (size > Available()) {
+                    throw std::runtime_error("IPC data is truncated");
+                }
+
+                arg.reserve(size);
+            } else {
+                if constexpr (IsRawStruct<type>()) {
+                    if (!compact_ || !HasVarint<type>()) {
+                        using layout = FieldsLayout<type>;
+
+                        if (size > Available() / std::max<size_t>(layout::Size, 1)) {
+                            throw std::runtime_error("IPC data is truncated");
+                        }
+
+                        arg.resize(size);
+
+                        const uint8_t* data = bytes_.data() + index_;
+
+                        for (auto& el : arg) {
+                            ReadFields(el, data, std::make_index_sequence<std::tuple_size_v<std::remove_const_t<decltype(Fields<type>::Members)>>>());
+                            data += layout::Size;
+                        }
+
+                        index_ += size * layout::Size;
+
+                        return unserializer;
+                    }
+                }
+
+                if constexpr (Reservable<T>::value) {
+                    // 'size' is not trusted, an element is at least 1 byte.
+                    arg.reserve(std::min(size, Available()));
+                }
+            }
+
             for (size_t i = 0; i < size; i++)
             {
-                type el;
-                unserializer >> el;
-
-                arg.emplace_back(el);
+                // Elements are unserialized in place, 'vector<bool>' has no references to elements.
+                if constexpr (std::is_reference_v<decltype(arg.back())>) {
+                    arg.emplace_back();
+                    unserializer >> arg.back();
+                } else {
+                    type el;
+                    unserializer >> el;
+
+                    arg.emplace_back(el);
+                }
             }
 
             return unserializer;
         }
 
+        // Ordered containers are built with 'end' hints, it is O(n) for sorted data as they are serialized.
         template <typename T>
         Unserializer& Set(T& arg) {
             Unserializer& unserializer = *this;
@@ -146,28 +831,35 @@ namespace IpcCall {
             arg.clear();
 
             size_t size;
-            unserializer.Unserialize(size);
+            unserializer.UnserializeSize(size);
+
+            ReserveAssociative(arg, size);
 
-            using type = std::decay_t<decltype(*arg.begin())>;
+            using type = typename T::value_type;
 
             for (size_t i = 0; i < size; i++) {
                 type el;
                 unserializer >> el;
 
-                arg.insert(el);
+                arg.emplace_hint(arg.end(), std::move(el));
             }
 
             return unserializer;
         }
 
-        template<typename TKey, typename TValue>
-        Unserializer& Map(std::map<TKey, TValue>& arg) {
+        template<typename T>
+        Unserializer& Map(T& arg) {
+            using TKey = typename T::key_type;
+            using TValue = typename T::mapped_type;
+
             Unserializer& unserializer = *this;
 
             arg.clear();
 
             size_t size;
-            unserializer.Unserialize(size);
+            unserializer.UnserializeSize(size);
+
+            ReserveAssociative(arg, size);
 
             for (size_t i = 0; i < size; i++) {
                 TKey key;
@@ -176,98 +868,278 @@ namespace IpcCall {
                 TValue value;
                 *this >> value;
 
-                arg.insert(std::make_pair(key, value));
+                arg.emplace_hint(arg.end(), std::move(key), std::move(value));
+            }
+
+            return unserializer;
+        }
+
+        // Unordered containers reserve buckets once, 'size' is not trusted, an element is at least 1 byte.
+        template <typename T>
+        void ReserveAssociative(T& arg, size_t size) {
+            if constexpr (Reservable<T>::value) {
+                arg.reserve(std::min(size, Available()));
             }
-
-            return unserializer;
         }
 
+        // The underlying container is unserialized in one pass, elements are not pushed.
         template<typename T>
         Unserializer& ContainerAdapter(T& arg) {
-            Unserializer& unserializer = *this;
+            return *this >> UnderlyingContainer(arg);
+        }
 
-            arg = {};
+        template<typename T>
+        Unserializer& String(T& arg) {
+            using type = typename T::value_type;
 
-            size_t size;
-            unserializer.Unserialize(size);
+            size_t length;
+            if (format_ == Format::Legacy) {
+                length = NullTerminatedLength<type>();
+            } else {
+                UnserializeSize(length);
 
-            using type = std::decay_t<decltype(arg.top())>;
+                if (length > Available() / sizeof(type)) {
+                    throw std::runtime_error("IPC data is truncated");
+                }
+            }
 
-            for (size_t i = 0; i < size; i++) {
-                type el;
-                unserializer >> el;
+            arg.resize(length);
+            Read(arg.data(), length * sizeof(type));
 
-                arg.push(el);
+            if (format_ == Format::Legacy) {
+                index_ += sizeof(type);
             }
 
-            return unserializer;
+            return *this;
         }
 
-        template<typename T>
-        Unserializer& String(T& arg) {
-            arg.clear();
+    private:
+        template <typename T, size_t ...I>
+        static void ReadFields(T& arg, const uint8_t* data, std::index_sequence<I...>) {
+            using layout = FieldsLayout<T>;
 
-            using type = std::remove_reference_t<decltype(arg[0])>;
+            (memcpy(&(arg.*std::get<I>(Fields<T>::Members)), data + layout::template Offset<I>(), sizeof(typename layout::template type<I>)), ...);
+        }
 
-            const type zero = {};
+        // Number of characters before the terminator of a 'Legacy' string.
+        template<typename T>
+        size_t NullTerminatedLength() const {
+            const auto begin = bytes_.data() + index_;
+            const size_t available = Available() / sizeof(T);
+
+            if constexpr (sizeof(T) == 1) {
+                const auto end = static_cast<const uint8_t*>(memchr(begin, 0, available));
+                if (end == nullptr) {
+                    throw std::runtime_error("IPC data is truncated");
+                }
 
-            type c;
-            while (true) {
-                this->Unserialize(c);
-                if (c == zero) {
-                    break;
+                return end - begin;
+            } else {
+                for (size_t length = 0; length < available; length++) {
+                    T c;
+                    memcpy(&c, begin + length * sizeof(T), sizeof(T));
+                    if (c == T{}) {
+                        return length;
+                    }
                 }
 
-                arg.push_back(c);
+                throw std::runtime_error("IPC data is truncated");
             }
-
-            return *this;
         }
 
-    private:
         const bytes_t& bytes_;
-        int index_ = 0;
+        size_t index_ = 0;
+        Format format_;
+        bool compact_ = false;
+        StreamChannel* channel_ = nullptr;
     };
 
-    // Built-in types
+    // Built-in types, trivially serializable custom structs and structs declared by 'IPC_SERIALIZABLE'
     template <typename T>
     Serializer& operator << (Serializer& serializer, const T& arg) {
         static_assert(!std::is_pointer_v<T>, "Cannot serialize pointer");
 
-        static_assert(!std::is_class_v<T>, "Unserializable class");
+        static_assert(!std::is_class_v<T> || IsTriviallySerializable<T>() || Fields<T>::Declared, "Unserializable class, it can be declared by 'IPC_SERIALIZABLE'");
 
-        serializer.Serialize(arg);
+        if constexpr (Fields<T>::Declared) {
+            return serializer.Struct(arg);
+        } else {
+            if constexpr (IsVarint<T>()) {
+                if (serializer.IsCompact()) {
+                    serializer.WriteInteger(arg);
+                    return serializer;
+                }
+            }
 
-        return serializer;
+            serializer.Serialize(arg);
+
+            return serializer;
+        }
     }
 
     template <typename T>
     Unserializer& operator >> (Unserializer& unserializer, T& arg) {
         static_assert(!std::is_pointer_v<T>, "Cannot unserialize pointer");
 
-        static_assert(!std::is_class_v<T>, "Unserializable class");
+        static_assert(!std::is_class_v<T> || IsTriviallySerializable<T>() || Fields<T>::Declared, "Unserializable class, it can be declared by 'IPC_SERIALIZABLE'");
+
+        if constexpr (Fields<T>::Declared) {
+            return unserializer.Struct(arg);
+        } else {
+            if constexpr (IsVarint<T>()) {
+                if (unserializer.IsCompact()) {
+                    unserializer.ReadInteger(arg);
+                    return unserializer;
+                }
+            }
 
-        unserializer.Unserialize(arg);
+            unserializer.Unserialize(arg);
 
-        return unserializer;
+            return unserializer;
+        }
     }
 
-    // string
-    inline Serializer& operator << (Serializer& serializer, const std::string& arg) {
+    // string, wstring
+    template<typename C, typename Traits, typename A>
+    Serializer& operator << (Serializer& serializer, const std::basic_string<C, Traits, A>& arg) {
         return serializer.String(arg);
     }
 
-    inline Unserializer& operator >> (Unserializer& unserializer, std::string& arg) {
+    template<typename C, typename Traits, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::basic_string<C, Traits, A>& arg) {
         return unserializer.String(arg);
     }
 
-    // wstring
-    inline Serializer& operator << (Serializer& serializer, const std::wstring& arg) {
-        return serializer.String(arg);
+    // string_view, wstring_view
+    // On the server, a view parameter points into the request 'bytes', it is valid during the call.
+    // Unlike 'std::basic_string', characters are aligned to 'sizeof(C)' in the message.
+    template<typename C, typename Traits>
+    Serializer& operator << (Serializer& serializer, const std::basic_string_view<C, Traits>& arg) {
+        if (serializer.GetFormat() != Format::Legacy) {
+            serializer << arg.size();
+        }
+
+        serializer.Align(alignof(C));
+        serializer.Write(arg.data(), arg.size() * sizeof(C));
+
+        if (serializer.GetFormat() == Format::Legacy) {
+            serializer.Serialize(C{});
+        }
+
+        return serializer;
     }
 
-    inline Unserializer& operator >> (Unserializer& unserializer, std::wstring& arg) {
-        return unserializer.String(arg);
+    template<typename C, typename Traits>
+    Unserializer& operator >> (Unserializer& unserializer, std::basic_string_view<C, Traits>& arg) {
+        size_t size = 0;
+        if (unserializer.GetFormat() != Format::Legacy) {
+            unserializer.UnserializeSize(size);
+        }
+
+        unserializer.Align(alignof(C));
+
+        if (unserializer.GetFormat() == Format::Legacy) {
+            const auto data = unserializer.View<C>(0);
+            while (size < unserializer.Available() / sizeof(C) && data[size] != C{}) {
+                size++;
+            }
+        }
+
+        arg = { unserializer.View<C>(size), size };
+
+        if (unserializer.GetFormat() == Format::Legacy) {
+            unserializer.View<C>(1);
+        }
+
+        return unserializer;
+    }
+
+#ifdef __cpp_lib_span
+    // span of trivially serializable elements
+    // On the server, a 'std::span<const T>' parameter points into the request 'bytes', it is valid during the call.
+    template<typename T, size_t N>
+    Serializer& operator << (Serializer& serializer, const std::span<T, N>& arg) {
+        static_assert(IsTriviallySerializable<std::remove_const_t<T>>(), "Only span of trivially serializable elements can be serialized");
+
+        serializer << arg.size();
+
+        serializer.Align(alignof(T));
+        serializer.Write(arg.data(), arg.size_bytes());
+
+        return serializer;
+    }
+
+    template<typename T, size_t N>
+    Unserializer& operator >> (Unserializer& unserializer, std::span<const T, N>& arg) {
+        static_assert(IsTriviallySerializable<T>(), "Only span of trivially serializable elements can be unserialized");
+
+        size_t size;
+        unserializer >> size;
+
+        if (N != std::dynamic_extent && size != N) {
+            throw std::runtime_error("IPC span has wrong size");
+        }
+
+        unserializer.Align(alignof(T));
+
+        arg = std::span<const T, N>(unserializer.View<T>(size), size);
+
+        return unserializer;
+    }
+#endif
+
+    // Header, also sets the format of the rest of the request.
+    inline Serializer& operator << (Serializer& serializer, const Header& header) {
+        if (header.format != Format::Legacy) {
+            serializer << Header::Magic << header.format;
+        }
+
+        if (header.format >= Format::Flags) {
+            serializer << header.flags;
+
+            if (header.flags & HasCallId) {
+                serializer << header.callId;
+            }
+
+            if (header.flags & HasDeadline) {
+                serializer << header.deadline;
+            }
+        }
+
+        serializer.SetFormat(header.format);
+        serializer.SetCompact(header.flags & Compact);
+
+        return serializer;
+    }
+
+    inline Unserializer& operator >> (Unserializer& unserializer, Header& header) {
+        header = {};
+
+        if (unserializer.Peek() == Header::Magic) {
+            uint8_t magic;
+            unserializer >> magic >> header.format;
+
+            if (header.format == Format::Legacy || header.format > Format::Latest) {
+                throw std::runtime_error("Unsupported IPC format " + std::to_string(static_cast<int>(header.format)));
+            }
+
+            if (header.format >= Format::Flags) {
+                unserializer >> header.flags;
+
+                if (header.flags & HasCallId) {
+                    unserializer >> header.callId;
+                }
+
+                if (header.flags & HasDeadline) {
+                    unserializer >> header.deadline;
+                }
+            }
+        }
+
+        unserializer.SetFormat(header.format);
+        unserializer.SetCompact(header.flags & Compact);
+
+        return unserializer;
     }
 
     // vector
@@ -306,17 +1178,42 @@ namespace IpcCall {
     // forward_list
     template<typename T>
     Serializer& operator << (Serializer& serializer, const std::forward_list<T>& arg) {
-        return serializer.SequenceContainer(arg);
+        serializer << static_cast<size_t>(std::distance(arg.begin(), arg.end()));
+
+        for (const auto& el : arg) {
+            serializer << el;
+        }
+
+        return serializer;
     }
 
     template<typename T>
     Unserializer& operator >> (Unserializer& unserializer, std::forward_list<T>& arg) {
-        return unserializer.SequenceContainer(arg);
+        arg.clear();
+
+        size_t size;
+        unserializer >> size;
+
+        auto it = arg.before_begin();
+
+        for (size_t i = 0; i < size; i++) {
+            it = arg.emplace_after(it);
+            unserializer >> *it;
+        }
+
+        return unserializer;
     }
 
     // array
-    template<typename T, int N>
+    template<typename T, size_t N>
     Serializer& operator << (Serializer& serializer, const std::array<T, N>& arg) {
+        if constexpr (IsTriviallySerializable<T>()) {
+            if (!serializer.IsCompact() || !IsVarint<T>()) {
+                serializer.Write(arg.data(), sizeof(arg));
+                return serializer;
+            }
+        }
+
         for (const auto& el : arg) {
             serializer << el;
         }
@@ -324,8 +1221,15 @@ namespace IpcCall {
         return serializer;
     }
 
-    template<typename T, int N>
+    template<typename T, size_t N>
     Unserializer& operator >> (Unserializer& unserializer, std::array<T, N>& arg) {
+        if constexpr (IsTriviallySerializable<T>()) {
+            if (!unserializer.IsCompact() || !IsVarint<T>()) {
+                unserializer.Read(arg.data(), sizeof(arg));
+                return unserializer;
+            }
+        }
+
         for (size_t i = 0; i < arg.size(); i++) {
             T el;
             unserializer >> el;
@@ -337,136 +1241,128 @@ namespace IpcCall {
     }
 
     // set
-    template<typename T>
-    Serializer& operator << (Serializer& serializer, const std::set<T>& arg) {
+    template<typename T, typename Compare, typename A>
+    Serializer& operator << (Serializer& serializer, const std::set<T, Compare, A>& arg) {
         return serializer.Set(arg);
     }
 
-    template<typename T>
-    Unserializer& operator >> (Unserializer& unserializer, std::set<T>& arg) {
+    template<typename T, typename Compare, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::set<T, Compare, A>& arg) {
         return unserializer.Set(arg);
     }
 
     // unordered_set
-    template<typename T>
-    Serializer& operator << (Serializer& serializer, const std::unordered_set<T>& arg) {
+    template<typename T, typename Hash, typename Eq, typename A>
+    Serializer& operator << (Serializer& serializer, const std::unordered_set<T, Hash, Eq, A>& arg) {
         return serializer.Set(arg);
     }
 
-    template<typename T>
-    Unserializer& operator >> (Unserializer& unserializer, std::unordered_set<T>& arg) {
+    template<typename T, typename Hash, typename Eq, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::unordered_set<T, Hash, Eq, A>& arg) {
         return unserializer.Set(arg);
     }
 
     // multiset
-    template<typename T>
-    Serializer& operator << (Serializer& serializer, const std::multiset<T>& arg) {
+    template<typename T, typename Compare, typename A>
+    Serializer& operator << (Serializer& serializer, const std::multiset<T, Compare, A>& arg) {
         return serializer.Set(arg);
     }
 
-    template<typename T>
-    Unserializer& operator >> (Unserializer& unserializer, std::multiset<T>& arg) {
+    template<typename T, typename Compare, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::multiset<T, Compare, A>& arg) {
+        return unserializer.Set(arg);
+    }
+
+    // unordered_multiset
+    template<typename T, typename Hash, typename Eq, typename A>
+    Serializer& operator << (Serializer& serializer, const std::unordered_multiset<T, Hash, Eq, A>& arg) {
+        return serializer.Set(arg);
+    }
+
+    template<typename T, typename Hash, typename Eq, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::unordered_multiset<T, Hash, Eq, A>& arg) {
         return unserializer.Set(arg);
     }
 
     // map
-    template<typename TKey, typename TValue>
-    Serializer& operator << (Serializer& serializer, const std::map<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Compare, typename A>
+    Serializer& operator << (Serializer& serializer, const std::map<TKey, TValue, Compare, A>& arg) {
         return serializer.Map(arg);
     }
 
-    template<typename TKey, typename TValue>
-    Unserializer& operator >> (Unserializer& unserializer, std::map<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Compare, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::map<TKey, TValue, Compare, A>& arg) {
         return unserializer.Map(arg);
     }
 
     // unordered_map
-    template<typename TKey, typename TValue>
-    Serializer& operator << (Serializer& serializer, const std::unordered_map<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Hash, typename Eq, typename A>
+    Serializer& operator << (Serializer& serializer, const std::unordered_map<TKey, TValue, Hash, Eq, A>& arg) {
         return serializer.Map(arg);
     }
 
-    template<typename TKey, typename TValue>
-    Unserializer& operator >> (Unserializer& unserializer, std::unordered_map<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Hash, typename Eq, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::unordered_map<TKey, TValue, Hash, Eq, A>& arg) {
         return unserializer.Map(arg);
     }
 
     // multimap
-    template<typename TKey, typename TValue>
-    Serializer& operator << (Serializer& serializer, const std::multimap<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Compare, typename A>
+    Serializer& operator << (Serializer& serializer, const std::multimap<TKey, TValue, Compare, A>& arg) {
         return serializer.Map(arg);
     }
 
-    template<typename TKey, typename TValue>
-    Unserializer& operator >> (Unserializer& unserializer, std::multimap<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Compare, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::multimap<TKey, TValue, Compare, A>& arg) {
         return unserializer.Map(arg);
     }
 
     // unordered_multimap
-    template<typename TKey, typename TValue>
-    Serializer& operator << (Serializer& serializer, const std::unordered_multimap<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Hash, typename Eq, typename A>
+    Serializer& operator << (Serializer& serializer, const std::unordered_multimap<TKey, TValue, Hash, Eq, A>& arg) {
         return serializer.Map(arg);
     }
 
-    template<typename TKey, typename TValue>
-    Unserializer& operator >> (Unserializer& unserializer, std::unordered_multimap<TKey, TValue>& arg) {
+    template<typename TKey, typename TValue, typename Hash, typename Eq, typename A>
+    Unserializer& operator >> (Unserializer& unserializer, std::unordered_multimap<TKey, TValue, Hash, Eq, A>& arg) {
         return unserializer.Map(arg);
     }
 
     // stack
-    template<typename T>
-    Serializer& operator << (Serializer& serializer, const std::stack<T>& arg) {
+    template<typename T, typename C>
+    Serializer& operator << (Serializer& serializer, const std::stack<T, C>& arg) {
         return serializer.ContainerAdapter(arg);
     }
 
-    template<typename T>
-    Unserializer& operator >> (Unserializer& unserializer, std::stack<T>& arg) {
+    template<typename T, typename C>
+    Unserializer& operator >> (Unserializer& unserializer, std::stack<T, C>& arg) {
         return unserializer.ContainerAdapter(arg);
     }
 
     // queue
-    template<typename T>
-    Serializer& operator << (Serializer& serializer, const std::queue<T>& arg) {
-        auto tmp = arg;
-
-        serializer << arg.size();
-
-        while (!tmp.empty()) {
-            serializer << tmp.front();
-            tmp.pop();
-        }
-
-        return serializer;
+    template<typename T, typename C>
+    Serializer& operator << (Serializer& serializer, const std::queue<T, C>& arg) {
+        return serializer.ContainerAdapter(arg);
     }
 
-    template<typename T>
-    Unserializer& operator >> (Unserializer& unserializer, std::queue<T>& arg) {
-        arg = {};
-
-        size_t size;
-        unserializer.Unserialize(size);
-
-        using type = std::decay_t<decltype(arg.front())>;
-
-        for (size_t i = 0; i < size; i++) {
-            type el;
-            unserializer >> el;
-
-            arg.push(el);
-        }
-
-        return unserializer;
+    template<typename T, typename C>
+    Unserializer& operator >> (Unserializer& unserializer, std::queue<T, C>& arg) {
+        return unserializer.ContainerAdapter(arg);
     }
 
     // priority_queue
-    template<typename T>
-    Serializer& operator << (Serializer& serializer, const std::priority_queue<T>& arg) {
+    template<typename T, typename C, typename Compare>
+    Serializer& operator << (Serializer& serializer, const std::priority_queue<T, C, Compare>& arg) {
         return serializer.ContainerAdapter(arg);
     }
 
-    template<typename T>
-    Unserializer& operator >> (Unserializer& unserializer, std::priority_queue<T>& arg) {
-        return unserializer.ContainerAdapter(arg);
+    template<typename T, typename C, typename Compare>
+    Unserializer& operator >> (Unserializer& unserializer, std::priority_queue<T, C, Compare>& arg) {
+        unserializer.ContainerAdapter(arg);
+
+        MakeHeap(arg);
+
+        return unserializer;
     }
 
     // tuple
@@ -516,8 +1412,290 @@ namespace IpcCall {
         return unserializer >> arg.first >> arg.second;
     }
 
+    // Number of bytes that 'operator <<' writes, it is used to reserve a message buffer once.
+    // If 'Fixed', every value of the type is serialized in 'FixedSize' bytes.
+    // A custom type can specialize it, otherwise its size is not counted.
+    template <typename T, typename = void>
+    struct SerializedSize {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const T&, Format) {
+            return 0;
+        }
+    };
+
+    template <typename T>
+    size_t SizeOf(const T& arg, Format format) {
+        return SerializedSize<T>::Size(arg, format);
+    }
+
+    // Size of elements of a container.
+    template <typename T>
+    size_t SizeOfElements(const T& arg, size_t count, Format format) {
+        using type = std::decay_t<decltype(*arg.begin())>;
+
+        if constexpr (SerializedSize<type>::Fixed) {
+            return count * SerializedSize<type>::FixedSize;
+        } else {
+            size_t size = 0;
+            for (const auto& el : arg) {
+                size += SizeOf(el, format);
+            }
+
+            return size;
+        }
+    }
+
+    // Built-in types and trivially serializable custom structs
+    template <typename T>
+    struct SerializedSize<T, std::enable_if_t<IsTriviallySerializable<T>()>> {
+        static constexpr bool Fixed = true;
+        static constexpr size_t FixedSize = sizeof(T);
+
+        static constexpr size_t Size(const T&, Format) {
+            return FixedSize;
+        }
+    };
+
+    // Structs declared by 'IPC_SERIALIZABLE'
+    template <typename T>
+    struct SerializedSize<T, std::enable_if_t<Fields<T>::Declared>> {
+        static constexpr bool Fixed = FieldsLayout<T>::Raw;
+        static constexpr size_t FixedSize = Fixed ? FieldsLayout<T>::Size : 0;
+
+        static size_t Size(const T& arg, Format format) {
+            if constexpr (Fixed) {
+                return FixedSize;
+            } else {
+                return std::apply([&](auto... member) { return (SizeOf(arg.*member, format) + ... + 0); }, Fields<T>::Members);
+            }
+        }
+    };
+
+    // Sequence containers, sets and maps
+    template <typename T>
+    struct SequenceSerializedSize {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const T& arg, Format format) {
+            return sizeof(size_t) + SizeOfElements(arg, arg.size(), format);
+        }
+    };
+
+    template <typename C, typename Traits, typename A>
+    struct SerializedSize<std::basic_string<C, Traits, A>> {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const std::basic_string<C, Traits, A>& arg, Format format) {
+            return format == Format::Legacy ? (arg.size() + 1) * sizeof(C) : sizeof(size_t) + arg.size() * sizeof(C);
+        }
+    };
+
+    template <typename T>
+    struct SerializedSize<std::vector<T>>: SequenceSerializedSize<std::vector<T>> {};
+
+    template <typename T>
+    struct SerializedSize<std::list<T>>: SequenceSerializedSize<std::list<T>> {};
+
+    template <typename T>
+    struct SerializedSize<std::deque<T>>: SequenceSerializedSize<std::deque<T>> {};
+
+    template <typename T>
+    struct SerializedSize<std::forward_list<T>> {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const std::forward_list<T>& arg, Format format) {
+            return sizeof(size_t) + SizeOfElements(arg, std::distance(arg.begin(), arg.end()), format);
+        }
+    };
+
+    template <typename T, typename Compare, typename A>
+    struct SerializedSize<std::set<T, Compare, A>>: SequenceSerializedSize<std::set<T, Compare, A>> {};
+
+    template <typename T, typename Hash, typename Eq, typename A>
+    struct SerializedSize<std::unordered_set<T, Hash, Eq, A>>: SequenceSerializedSize<std::unordered_set<T, Hash, Eq, A>> {};
+
+    template <typename T, typename Compare, typename A>
+    struct SerializedSize<std::multiset<T, Compare, A>>: SequenceSerializedSize<std::multiset<T, Compare, A>> {};
+
+    template <typename T, typename Hash, typename Eq, typename A>
+    struct SerializedSize<std::unordered_multiset<T, Hash, Eq, A>>: SequenceSerializedSize<std::unordered_multiset<T, Hash, Eq, A>> {};
+
+    template <typename TKey, typename TValue, typename Compare, typename A>
+    struct SerializedSize<std::map<TKey, TValue, Compare, A>>: SequenceSerializedSize<std::map<TKey, TValue, Compare, A>> {};
+
+    template <typename TKey, typename TValue, typename Hash, typename Eq, typename A>
+    struct SerializedSize<std::unordered_map<TKey, TValue, Hash, Eq, A>>: SequenceSerializedSize<std::unordered_map<TKey, TValue, Hash, Eq, A>> {};
+
+    template <typename TKey, typename TValue, typename Compare, typename A>
+    struct SerializedSize<std::multimap<TKey, TValue, Compare, A>>: SequenceSerializedSize<std::multimap<TKey, TValue, Compare, A>> {};
+
+    template <typename TKey, typename TValue, typename Hash, typename Eq, typename A>
+    struct SerializedSize<std::unordered_multimap<TKey, TValue, Hash, Eq, A>>: SequenceSerializedSize<std::unordered_multimap<TKey, TValue, Hash, Eq, A>> {};
+
+    // stack, queue, priority_queue
+    template <typename T>
+    struct AdapterSerializedSize {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const T& arg, Format format) {
+            return sizeof(size_t) + SizeOfElements(UnderlyingContainer(arg), arg.size(), format);
+        }
+    };
+
+    template <typename T, typename C>
+    struct SerializedSize<std::stack<T, C>>: AdapterSerializedSize<std::stack<T, C>> {};
+
+    template <typename T, typename C>
+    struct SerializedSize<std::queue<T, C>>: AdapterSerializedSize<std::queue<T, C>> {};
+
+    template <typename T, typename C, typename Compare>
+    struct SerializedSize<std::priority_queue<T, C, Compare>>: AdapterSerializedSize<std::priority_queue<T, C, Compare>> {};
+
+    // array of not trivially serializable elements
+    template <typename T, size_t N>
+    struct SerializedSize<std::array<T, N>, std::enable_if_t<!IsTriviallySerializable<T>()>> {
+        static constexpr bool Fixed = SerializedSize<T>::Fixed;
+        static constexpr size_t FixedSize = N * SerializedSize<T>::FixedSize;
+
+        static size_t Size(const std::array<T, N>& arg, Format format) {
+            return SizeOfElements(arg, N, format);
+        }
+    };
+
+    // tuple
+    template <typename ...Ts>
+    struct SerializedSize<std::tuple<Ts...>> {
+        static constexpr bool Fixed = (SerializedSize<Ts>::Fixed && ...);
+        static constexpr size_t FixedSize = Fixed ? (SerializedSize<Ts>::FixedSize + ... + 0) : 0;
+
+        static size_t Size(const std::tuple<Ts...>& arg, Format format) {
+            if constexpr (Fixed) {
+                return FixedSize;
+            } else {
+                return std::apply([format](const auto&... el) { return (SizeOf(el, format) + ... + 0); }, arg);
+            }
+        }
+    };
+
+    // pair, also an element of a map
+    template <typename T1, typename T2>
+    struct SerializedSize<std::pair<T1, T2>> {
+        using first_t = SerializedSize<std::remove_const_t<T1>>;
+        using second_t = SerializedSize<T2>;
+
+        static constexpr bool Fixed = first_t::Fixed && second_t::Fixed;
+        static constexpr size_t FixedSize = Fixed ? first_t::FixedSize + second_t::FixedSize : 0;
+
+        static size_t Size(const std::pair<T1, T2>& arg, Format format) {
+            return SizeOf(arg.first, format) + SizeOf(arg.second, format);
+        }
+    };
+
+    // string_view, wstring_view, the size includes the maximum padding
+    template <typename C, typename Traits>
+    struct SerializedSize<std::basic_string_view<C, Traits>> {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const std::basic_string_view<C, Traits>& arg, Format format) {
+            return alignof(C) - 1 + (format == Format::Legacy ? (arg.size() + 1) * sizeof(C) : sizeof(size_t) + arg.size() * sizeof(C));
+        }
+    };
+
+#ifdef __cpp_lib_span
+    // span, the size includes the maximum padding
+    template <typename T, size_t N>
+    struct SerializedSize<std::span<T, N>> {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const std::span<T, N>& arg, Format) {
+            return sizeof(size_t) + alignof(T) - 1 + arg.size_bytes();
+        }
+    };
+#endif
+
+    // Header
+    template <>
+    struct SerializedSize<Header> {
+        static constexpr bool Fixed = false;
+        static constexpr size_t FixedSize = 0;
+
+        static size_t Size(const Header& header, Format) {
+            if (header.format == Format::Legacy) {
+                return 0;
+            }
+
+            if (header.format == Format::LengthPrefixed) {
+                return sizeof(Header::Magic) + sizeof(Format);
+            }
+
+            return sizeof(Header::Magic) + sizeof(Format) + sizeof(header.flags) + (header.flags & HasCallId ? sizeof(header.callId) : 0) +
+                   (header.flags & HasDeadline ? sizeof(header.deadline) : 0);
+        }
+    };
+
     template <typename Param>
     static constexpr bool IsOutParam() {
         return std::is_lvalue_reference_v<Param> && !std::is_const_v<std::remove_reference_t<Param>>;
     }
 }
+
+// Declares serialization of custom struct 'Type' field by field, in the order of 'fields' (up to 32), for instance:
+//   IPC_SERIALIZABLE(Data, str_, n_);
+// It is used at global scope, after the definition of the struct. Fields should be serializable,
+// a struct that has only trivially serializable fields is copied at offsets known at compile time,
+// and if there is no padding, as a whole, so a vector of it is copied with a single 'memcpy'.
+#define IPC_SERIALIZABLE(Type, ...) \
+    template <> struct IpcCall::Fields<Type> { \
+        static constexpr bool Declared = true; \
+        static constexpr auto Members = std::make_tuple(IPC_CALL_FOR_EACH(IPC_CALL_FIELD_MEMBER, Type, __VA_ARGS__)); \
+        template <typename T> \
+        static constexpr auto Offsets() { return std::array<size_t, std::tuple_size_v<std::remove_const_t<decltype(Members)>>>{ IPC_CALL_FOR_EACH(IPC_CALL_FIELD_OFFSET, T, __VA_ARGS__) }; } \
+    }
+
+#define IPC_CALL_FIELD_MEMBER(Type, field) &Type::field
+#define IPC_CALL_FIELD_OFFSET(Type, field) offsetof(Type, field)
+
+// 'm(Type, field)' for every field, separated by commas. 'IPC_CALL_EXPAND' is for the MSVC traditional preprocessor.
+#define IPC_CALL_EXPAND(x) x
+#define IPC_CALL_FOR_EACH(m, Type, ...) IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_N(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) IPC_CALL_FOR_EACH_##N
+#define IPC_CALL_FOR_EACH_1(m, Type, field) m(Type, field)
+#define IPC_CALL_FOR_EACH_2(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_1(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_3(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_2(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_4(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_3(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_5(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_4(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_6(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_5(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_7(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_6(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_8(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_7(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_9(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_8(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_10(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_9(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_11(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_10(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_12(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_11(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_13(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_12(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_14(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_13(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_15(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_14(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_16(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_15(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_17(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_16(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_18(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_17(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_19(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_18(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_20(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_19(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_21(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_20(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_22(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_21(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_23(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_22(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_24(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_23(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_25(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_24(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_26(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_25(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_27(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_26(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_28(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_27(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_29(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_28(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_30(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_29(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_31(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_30(m, Type, __VA_ARGS__))
+#define IPC_CALL_FOR_EACH_32(m, Type, field, ...) m(Type, field), IPC_CALL_EXPAND(IPC_CALL_FOR_EACH_31(m, Type, __VA_ARGS__))
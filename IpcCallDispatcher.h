@@ -0,0 +1,624 @@
+// Multi-threaded execution of server calls.
+//
+// 'Dispatcher' runs 'Server::SyncCall' and 'Server::AsyncCall' on a pool of worker threads.
+// Every worker has its own queue, an idle worker steals calls from the queues of other workers.
+//
+// Admission bounds the calls that wait for a worker, so a burst degrades by failing calls instead of growing
+// the queues. 'maxQueued' of the constructor bounds all waiting calls, 'Limits' of a function (of
+// 'IPC_CALL_REGISTER_LIMITED' or 'SetLimits') bound its calls in flight and its waiting calls.
+// A call that is not admitted fails with 'Overloaded', its 'completion' is called with the error.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "IpcCallServer.h"
+
+namespace IpcCall {
+  // How 'Dispatcher' executes calls of a function.
+  enum class Execution {
+    Parallel,   // On any worker, calls run in parallel (default).
+    Serialized, // On any worker, one call at a time in the order they are received.
+    Pinned,     // Always on the same worker.
+  };
+
+  // Admission gauges and counters of a function, or of all calls of 'Dispatcher'.
+  struct AdmissionStats {
+    size_t inFlight = 0; // Admitted calls of a function, or executing calls of 'Dispatcher'.
+    size_t queued = 0;   // Calls that wait for admission of a function, or for a worker.
+    uint64_t rejected = 0;
+    uint64_t dropped = 0;
+  };
+
+  struct Dispatcher {
+    // Up to 'maxQueued' calls wait for a worker, 'overload' is applied to a call over it.
+    explicit Dispatcher(size_t threadCount = std::thread::hardware_concurrency(),
+                        size_t maxQueued = Limits::Unlimited, Overload overload = Overload::Reject) :
+      maxQueued_(maxQueued), overload_(overload) {
+      threadCount = std::max<size_t>(threadCount, 1);
+
+      for (const auto& [funcName, pFunc] : Server::Functions::Instance().All()) {
+        if (pFunc->limits.maxInFlight != Limits::Unlimited || pFunc->limits.maxQueued != Limits::Unlimited) {
+          SetLimits(funcName, pFunc->limits);
+        }
+      }
+
+      for (size_t i = 0; i < threadCount; i++) {
+        workers_.push_back(std::make_unique<Worker>());
+      }
+
+      for (size_t i = 0; i < threadCount; i++) {
+        workers_[i]->thread = std::thread([this, i] { Work(i); });
+      }
+    }
+
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    // Executes all submitted calls, then stops the workers.
+    ~Dispatcher() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+
+      condition_.notify_all();
+
+      for (auto& worker : workers_) {
+        worker->thread.join();
+      }
+    }
+
+    size_t ThreadCount() const {
+      return workers_.size();
+    }
+
+    // Sets how calls of the registered function 'funcName' are executed, 'thread' is the worker of 'Execution::Pinned'.
+    // It should be called before calls are submitted.
+    void SetExecution(const std::string& funcName, Execution execution, size_t thread = 0) {
+      auto& policy = PolicyOf(funcName);
+      policy.execution = execution;
+      policy.thread = thread % workers_.size();
+
+      if (execution == Execution::Serialized && !policy.strand) {
+        policy.strand = std::make_unique<Strand>();
+      }
+    }
+
+    // Sets admission of calls of the registered function 'funcName', instead of the limits of its registration.
+    // It should be called before calls are submitted.
+    void SetLimits(const std::string& funcName, const Limits& limits) {
+      auto& policy = PolicyOf(funcName);
+
+      if (!policy.gate) {
+        policy.gate = std::make_unique<Gate>();
+      }
+
+      policy.gate->limits = limits;
+    }
+
+    // Calls that are executing and that wait for a worker, and calls that are rejected or dropped of all functions.
+    AdmissionStats Stats() const {
+      return { running_.load(), waiting_.load(), rejected_.load(), dropped_.load() };
+    }
+
+    // Admitted and queued calls of 'funcName', and its calls that are rejected or dropped.
+    AdmissionStats Stats(const std::string& funcName) const {
+      const auto pFunc = Server::Functions::Instance().FindFunction(std::string_view(funcName));
+
+      const auto it = policies_.find(pFunc);
+      if (it == policies_.end() || !it->second.gate) {
+        return {};
+      }
+
+      auto& gate = *it->second.gate;
+
+      std::lock_guard<std::mutex> lock(gate.mutex);
+
+      return { gate.inFlight, gate.queue.size(), gate.rejected, gate.dropped };
+    }
+
+    // It should be called by the server IPC transport with the 'bytes' that are received from the client,
+    // 'completion' is called on a worker thread with the reply that should be sent back to the client, it should not throw.
+    void SyncCall(bytes_t&& bytes, Completion completion) {
+      Submit({ std::move(bytes), std::move(completion), nullptr, nullptr, Deadline::Clock::now() });
+    }
+
+    // It should be called by the server IPC transport with the 'bytes' that are received from the client.
+    void AsyncCall(bytes_t&& bytes) {
+      Submit({ std::move(bytes), nullptr, nullptr, nullptr, Deadline::Clock::now() });
+    }
+
+  private:
+    struct Strand;
+    struct Policy;
+
+    // A call, or draining of 'strand'. 'policy' of a call of a function with limits is released when it completes.
+    // The deadline of the request is counted from 'received', so the time in the queues is a part of it.
+    struct Task {
+      bytes_t request;
+      Completion completion;
+      Strand* strand;
+      const Policy* policy = nullptr;
+      Deadline::Clock::time_point received = {};
+    };
+
+    // Calls of a 'Serialized' function, only one task drains them at a time.
+    struct Strand {
+      std::mutex mutex;
+      std::deque<Task> tasks;
+      bool scheduled = false;
+    };
+
+    // Admission of calls of a function with 'Limits', calls over 'maxInFlight' wait in 'queue'.
+    struct Gate {
+      Limits limits;
+      std::mutex mutex;
+      std::condition_variable space;
+      std::deque<Task> queue;
+      size_t inFlight = 0;
+      uint64_t rejected = 0;
+      uint64_t dropped = 0;
+    };
+
+    struct Policy {
+      Execution execution = Execution::Parallel;
+      size_t thread = 0;
+      std::unique_ptr<Strand> strand;
+      std::unique_ptr<Gate> gate;
+    };
+
+    struct Worker {
+      std::mutex mutex;
+      std::deque<Task> tasks;  // Can be stolen by other workers.
+      std::deque<Task> pinned; // Only for this worker.
+      std::atomic<size_t> pinnedCount = 0;
+      std::thread thread;
+    };
+
+    // A strand is drained by up to 'DrainBatch' calls at a time, so it doesn't hold a worker.
+    static constexpr size_t DrainBatch = 64;
+
+    // Worker that runs on the current thread.
+    struct Current {
+      Dispatcher* dispatcher = nullptr;
+      size_t index = 0;
+    };
+
+    static Current& CurrentWorker() {
+      static thread_local Current s_current;
+      return s_current;
+    }
+
+    Policy& PolicyOf(const std::string& funcName) {
+      const auto pFunc = Server::Functions::Instance().FindFunction(std::string_view(funcName));
+      if (pFunc == nullptr) {
+        throw std::runtime_error("IPC function '" + funcName + "' is not registered");
+      }
+
+      return policies_[pFunc];
+    }
+
+    void Submit(Task&& task) {
+      const Policy* policy = nullptr;
+
+      if (!policies_.empty()) {
+        try {
+          Unserializer unserializer(task.request);
+
+          auto it = policies_.find(Server::FindFunction(unserializer));
+          if (it != policies_.end()) {
+            policy = &it->second;
+          }
+        } catch (...) {
+          if (task.completion) {
+            task.completion({}, std::current_exception());
+          }
+
+          return;
+        }
+      }
+
+      if (!Admit(task)) {
+        return;
+      }
+
+      if (policy != nullptr && policy->gate && !Admit(*policy, task)) {
+        return;
+      }
+
+      Dispatch(policy, std::move(task));
+    }
+
+    void Dispatch(const Policy* policy, Task&& task) {
+      if (policy != nullptr && policy->execution == Execution::Pinned) {
+        PushPinned(policy->thread, std::move(task));
+        return;
+      }
+
+      if (policy != nullptr && policy->execution == Execution::Serialized) {
+        auto& strand = *policy->strand;
+
+        std::lock_guard<std::mutex> lock(strand.mutex);
+
+        strand.tasks.push_back(std::move(task));
+        if (strand.scheduled) {
+          return;
+        }
+
+        strand.scheduled = true;
+        task = { {}, nullptr, &strand };
+      }
+
+      Push(std::move(task));
+    }
+
+    // Admission of all calls, a call waits for a worker if 'maxQueued_' calls don't wait.
+    bool Admit(Task& task) {
+      if (maxQueued_ == Limits::Unlimited) {
+        waiting_.fetch_add(1);
+        return true;
+      }
+
+      while (true) {
+        auto waiting = waiting_.load();
+        if (waiting < maxQueued_) {
+          if (waiting_.compare_exchange_weak(waiting, waiting + 1)) {
+            return true;
+          }
+
+          continue;
+        }
+
+        if (overload_ == Overload::Block) {
+          std::unique_lock<std::mutex> lock(spaceMutex_);
+
+          blocked_.fetch_add(1);
+          space_.wait(lock, [this] { return waiting_.load() < maxQueued_; });
+          blocked_.fetch_sub(1);
+
+          continue;
+        }
+
+        // The oldest call of the longest queue is replaced, it is already counted in 'waiting_'.
+        Task oldest;
+        if (overload_ == Overload::DropOldest && PopOldest(oldest)) {
+          dropped_.fetch_add(1);
+          Fail(std::move(oldest));
+
+          return true;
+        }
+
+        rejected_.fetch_add(1);
+        Fail(std::move(task));
+
+        return false;
+      }
+    }
+
+    // Admission of a call of a function with limits, returns false if the call is queued or it fails.
+    bool Admit(const Policy& policy, Task& task) {
+      auto& gate = *policy.gate;
+
+      std::unique_lock<std::mutex> lock(gate.mutex);
+
+      while (true) {
+        task.policy = &policy;
+
+        if (gate.inFlight < gate.limits.maxInFlight) {
+          gate.inFlight++;
+          return true;
+        }
+
+        if (gate.queue.size() < gate.limits.maxQueued) {
+          gate.queue.push_back(std::move(task));
+          return false;
+        }
+
+        if (gate.limits.overload == Overload::Block) {
+          gate.space.wait(lock);
+          continue;
+        }
+
+        if (gate.limits.overload == Overload::DropOldest && !gate.queue.empty()) {
+          // It is not admitted, it doesn't release the admission.
+          Task oldest = std::move(gate.queue.front());
+          oldest.policy = nullptr;
+          gate.queue.pop_front();
+          gate.queue.push_back(std::move(task));
+          gate.dropped++;
+
+          lock.unlock();
+
+          dropped_.fetch_add(1);
+          Fail(std::move(oldest));
+          Dequeued();
+
+          return false;
+        }
+
+        gate.rejected++;
+
+        lock.unlock();
+
+        rejected_.fetch_add(1);
+        task.policy = nullptr;
+        Fail(std::move(task));
+        Dequeued();
+
+        return false;
+      }
+    }
+
+    // A call of a function with limits completed, the next queued call of the function is admitted.
+    void Release(const Policy& policy) {
+      auto& gate = *policy.gate;
+
+      Task next;
+      bool admitted = false;
+      {
+        std::lock_guard<std::mutex> lock(gate.mutex);
+
+        if (!gate.queue.empty()) {
+          next = std::move(gate.queue.front());
+          gate.queue.pop_front();
+          admitted = true;
+        } else {
+          gate.inFlight--;
+        }
+      }
+
+      if (gate.limits.overload == Overload::Block) {
+        gate.space.notify_all();
+      }
+
+      if (admitted) {
+        Dispatch(&policy, std::move(next));
+      }
+    }
+
+    // A call doesn't wait anymore, it executes or it fails.
+    void Dequeued() {
+      waiting_.fetch_sub(1);
+
+      if (blocked_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(spaceMutex_); }
+        space_.notify_all();
+      }
+    }
+
+    // Fails a call that is not admitted or dropped, a dropped call of a function with limits releases its admission.
+    void Fail(Task&& task) {
+      if (task.completion) {
+        task.completion({}, std::make_exception_ptr(Overloaded()));
+      }
+
+      BufferPool::Release(std::move(task.request));
+
+      if (task.policy != nullptr) {
+        Release(*task.policy);
+      }
+    }
+
+    // The first call of the longest worker queue, strands are not dropped.
+    bool PopOldest(Task& task) {
+      Worker* longest = nullptr;
+      size_t longestSize = 0;
+
+      for (auto& worker : workers_) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+
+        if (worker->tasks.size() > longestSize) {
+          longest = worker.get();
+          longestSize = worker->tasks.size();
+        }
+      }
+
+      if (longest == nullptr) {
+        return false;
+      }
+
+      std::lock_guard<std::mutex> lock(longest->mutex);
+
+      for (auto it = longest->tasks.begin(); it != longest->tasks.end(); ++it) {
+        if (it->strand == nullptr) {
+          task = std::move(*it);
+          longest->tasks.erase(it);
+          queued_.fetch_sub(1);
+
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    void Push(Task&& task) {
+      // A worker pushes to its own queue, other threads distribute calls between workers.
+      const auto& current = CurrentWorker();
+      const size_t index = current.dispatcher == this ? current.index : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+
+      auto& worker = *workers_[index];
+      {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+      }
+
+      queued_.fetch_add(1);
+
+      if (idle_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        condition_.notify_one();
+      }
+    }
+
+    void PushPinned(size_t index, Task&& task) {
+      auto& worker = *workers_[index];
+      {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.pinned.push_back(std::move(task));
+      }
+
+      worker.pinnedCount.fetch_add(1);
+
+      if (idle_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        condition_.notify_all();
+      }
+    }
+
+    bool PopPinned(size_t index, Task& task) {
+      auto& worker = *workers_[index];
+      if (worker.pinnedCount.load() == 0) {
+        return false;
+      }
+
+      std::lock_guard<std::mutex> lock(worker.mutex);
+
+      task = std::move(worker.pinned.front());
+      worker.pinned.pop_front();
+      worker.pinnedCount.fetch_sub(1);
+
+      return true;
+    }
+
+    // Own queue from the front, queues of other workers from the back.
+    bool Pop(size_t index, Task& task) {
+      for (size_t i = 0; i < workers_.size() && queued_.load() > 0; i++) {
+        auto& worker = *workers_[(index + i) % workers_.size()];
+
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) {
+          continue;
+        }
+
+        if (i == 0) {
+          task = std::move(worker.tasks.front());
+          worker.tasks.pop_front();
+        } else {
+          task = std::move(worker.tasks.back());
+          worker.tasks.pop_back();
+        }
+
+        queued_.fetch_sub(1);
+
+        return true;
+      }
+
+      return false;
+    }
+
+    void Work(size_t index) {
+      CurrentWorker() = { this, index };
+
+      auto& worker = *workers_[index];
+
+      while (true) {
+        Task task;
+        if (PopPinned(index, task) || Pop(index, task)) {
+          Run(std::move(task));
+          continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        const auto ready = [&] { return queued_.load() > 0 || worker.pinnedCount.load() > 0; };
+        if (stop_ && !ready()) {
+          return;
+        }
+
+        idle_.fetch_add(1);
+        condition_.wait(lock, [&] { return stop_ || ready(); });
+        idle_.fetch_sub(1);
+      }
+    }
+
+    void Run(Task&& task) {
+      if (task.strand != nullptr) {
+        Drain(*task.strand);
+        return;
+      }
+
+      Dequeued();
+      running_.fetch_add(1);
+
+      if (task.completion) {
+        bytes_t reply;
+        std::exception_ptr error;
+
+        try {
+          reply = Server::SyncCall(task.request, task.received);
+        } catch (...) {
+          error = std::current_exception();
+        }
+
+        task.completion(std::move(reply), error);
+      } else {
+        // There is no one to report an error of an asynchronous call to.
+        try {
+          Server::AsyncCall(task.request, task.received);
+        } catch (...) {
+        }
+      }
+
+      BufferPool::Release(std::move(task.request));
+
+      running_.fetch_sub(1);
+
+      if (task.policy != nullptr) {
+        Release(*task.policy);
+      }
+    }
+
+    void Drain(Strand& strand) {
+      for (size_t i = 0; i < DrainBatch; i++) {
+        Task task;
+        {
+          std::lock_guard<std::mutex> lock(strand.mutex);
+
+          if (strand.tasks.empty()) {
+            strand.scheduled = false;
+            return;
+          }
+
+          task = std::move(strand.tasks.front());
+          strand.tasks.pop_front();
+        }
+
+        Run(std::move(task));
+      }
+
+      Push({ {}, nullptr, &strand });
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::unordered_map<const Server::IFunction*, Policy> policies_;
+
+    std::atomic<size_t> next_ = 0;
+    std::atomic<size_t> queued_ = 0;
+    std::atomic<size_t> idle_ = 0;
+
+    // Admission of all calls.
+    const size_t maxQueued_;
+    const Overload overload_;
+    std::atomic<size_t> waiting_ = 0;
+    std::atomic<size_t> running_ = 0;
+    std::atomic<size_t> blocked_ = 0;
+    std::atomic<uint64_t> rejected_ = 0;
+    std::atomic<uint64_t> dropped_ = 0;
+    std::mutex spaceMutex_;
+    std::condition_variable space_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_ = false;
+  };
+}
@@ -0,0 +1,32 @@
+// Framing of messages in a byte stream, it is used by the transports.
+
+#pragma once
+
+#include <cstdint>
+
+namespace IpcCall {
+  enum class FrameKind: uint32_t {
+    SyncRequest = 1,
+    AsyncRequest = 2,
+    Reply = 3,
+    Error = 4, // Reply with the text of the server exception.
+
+    // Pipelined call, the request 'Header' has 'callId', the reply and the error start with it.
+    PipelinedRequest = 5,
+    PipelinedReply = 6,
+    PipelinedError = 7,
+
+    // Streaming call on its own connection, see 'IpcCallStream.h'. 'StreamRequest' is followed by 'StreamChunk' frames
+    // of its 'InStream' parameter and 'StreamEnd', the 'Reply' is followed by the chunks of its 'OutStream' return.
+    StreamRequest = 8,
+    StreamChunk = 9,
+    StreamEnd = 10,
+  };
+
+  // Frame is a 'FrameHeader' followed by 'size' bytes of the message.
+  struct FrameHeader {
+    FrameKind kind;
+    uint32_t reserved;
+    uint64_t size;
+  };
+}
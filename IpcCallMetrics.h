@@ -0,0 +1,498 @@
+// Per-function server metrics.
+//
+// The server counts calls, errors, parameter and reply bytes of every registered function, and records latency
+// histograms of the phases of a call: decode of the parameters, execution of the function and encode of the reply.
+// Every thread records into its own counters, they are merged when the metrics are read, so recording doesn't contend.
+// Only 1 of 'IPC_CALL_METRICS_SAMPLING' calls on a thread is timed, so reading the clock costs a fraction of a call.
+//
+//   // On the server
+//   for (const auto& f : IpcCall::Metrics::Snapshot()) { f.name, f.calls, f.execute.Percentile(0.99), ... }
+//
+//   // On the client, the server registers 'IpcCallMetrics'
+//   std::vector<IpcCall::FunctionMetrics> metrics = IPC_SEND_RECEIVE(IpcCallMetrics)()(ipcSync);
+//
+// 'IPC_CALL_METRICS' defined as 0 compiles the recording out.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include "IpcCallData.h"
+
+#ifndef IPC_CALL_METRICS
+#define IPC_CALL_METRICS 1
+#endif
+
+#ifndef IPC_CALL_METRICS_SAMPLING
+#define IPC_CALL_METRICS_SAMPLING 16
+#endif
+
+namespace IpcCall {
+  // Latency histogram in nanoseconds. Buckets are log-linear like in HDR histogram, every power of 2 is split
+  // into 'SubBuckets' linear buckets, so a value is recorded with relative error at most 1 / 'SubBuckets'.
+  struct LatencyHistogram {
+    static constexpr unsigned SubBits = 3;
+    static constexpr size_t SubBuckets = size_t(1) << SubBits;
+
+    // Values from 2^(MaxExponent + 1) ns (about 18 minutes) are counted in the last bucket.
+    static constexpr unsigned MaxExponent = 39;
+    static constexpr size_t BucketCount = (MaxExponent - SubBits + 2) * SubBuckets;
+
+    static size_t Bucket(uint64_t ns) {
+      if (ns < SubBuckets) {
+        return static_cast<size_t>(ns);
+      }
+
+      unsigned exponent = 0;
+      for (uint64_t v = ns; v >>= 1; ) {
+        exponent++;
+      }
+
+      if (exponent > MaxExponent) {
+        return BucketCount - 1;
+      }
+
+      return (exponent - SubBits + 1) * SubBuckets + ((ns >> (exponent - SubBits)) & (SubBuckets - 1));
+    }
+
+    // The smallest value of 'bucket'.
+    static uint64_t LowerBound(size_t bucket) {
+      if (bucket < SubBuckets) {
+        return bucket;
+      }
+
+      const unsigned exponent = static_cast<unsigned>(bucket / SubBuckets) + SubBits - 1;
+
+      return (SubBuckets + bucket % SubBuckets) << (exponent - SubBits);
+    }
+
+    void Record(uint64_t ns) {
+      counts[Bucket(ns)]++;
+      sum += ns;
+    }
+
+    void Merge(const LatencyHistogram& histogram) {
+      for (size_t i = 0; i < BucketCount; i++) {
+        counts[i] += histogram.counts[i];
+      }
+
+      sum += histogram.sum;
+    }
+
+    uint64_t Count() const {
+      uint64_t count = 0;
+      for (auto n : counts) {
+        count += n;
+      }
+
+      return count;
+    }
+
+    uint64_t Mean() const {
+      const auto count = Count();
+      return count ? sum / count : 0;
+    }
+
+    // The largest value of the bucket of quantile 'q' (from 0 to 1), 0 if the histogram is empty.
+    uint64_t Percentile(double q) const {
+      const auto count = Count();
+      if (count == 0) {
+        return 0;
+      }
+
+      const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+
+      uint64_t seen = 0;
+      for (size_t i = 0; i < BucketCount; i++) {
+        seen += counts[i];
+
+        if (seen >= rank) {
+          return i + 1 < BucketCount ? LowerBound(i + 1) - 1 : LowerBound(i);
+        }
+      }
+
+      return LowerBound(BucketCount - 1);
+    }
+
+    std::array<uint64_t, BucketCount> counts{};
+    uint64_t sum = 0;
+  };
+
+  // Metrics of a registered function, decode, execute and encode histograms are of the sampled calls that didn't throw.
+  struct FunctionMetrics {
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t errors = 0;       // Calls that threw.
+    uint64_t requestBytes = 0; // Parameters.
+    uint64_t replyBytes = 0;
+    uint64_t cacheHits = 0;    // Of a function registered by 'IPC_CALL_REGISTER_CACHED'.
+    uint64_t cacheMisses = 0;
+    uint64_t expired = 0;      // Calls that are dropped because their deadline expired, see 'Deadline'.
+
+    LatencyHistogram decode;
+    LatencyHistogram execute;
+    LatencyHistogram encode;
+  };
+
+  // Only non-empty buckets are sent.
+  inline Serializer& operator << (Serializer& serializer, const LatencyHistogram& histogram) {
+    std::vector<std::pair<uint16_t, uint64_t>> buckets;
+
+    for (size_t i = 0; i < LatencyHistogram::BucketCount; i++) {
+      if (histogram.counts[i]) {
+        buckets.emplace_back(static_cast<uint16_t>(i), histogram.counts[i]);
+      }
+    }
+
+    return serializer << histogram.sum << buckets;
+  }
+
+  inline Unserializer& operator >> (Unserializer& unserializer, LatencyHistogram& histogram) {
+    std::vector<std::pair<uint16_t, uint64_t>> buckets;
+    unserializer >> histogram.sum >> buckets;
+
+    histogram.counts = {};
+
+    for (const auto& [bucket, count] : buckets) {
+      if (bucket >= LatencyHistogram::BucketCount) {
+        throw std::runtime_error("IPC histogram bucket is out of range");
+      }
+
+      histogram.counts[bucket] = count;
+    }
+
+    return unserializer;
+  }
+
+  inline Serializer& operator << (Serializer& serializer, const FunctionMetrics& metrics) {
+    return serializer << metrics.name << metrics.calls << metrics.errors << metrics.requestBytes << metrics.replyBytes
+                      << metrics.cacheHits << metrics.cacheMisses << metrics.expired << metrics.decode << metrics.execute << metrics.encode;
+  }
+
+  inline Unserializer& operator >> (Unserializer& unserializer, FunctionMetrics& metrics) {
+    return unserializer >> metrics.name >> metrics.calls >> metrics.errors >> metrics.requestBytes >> metrics.replyBytes
+                        >> metrics.cacheHits >> metrics.cacheMisses >> metrics.expired >> metrics.decode >> metrics.execute >> metrics.encode;
+  }
+
+  struct Metrics {
+    // Merged metrics of every registered function, in the order of registration.
+    static std::vector<FunctionMetrics> Snapshot() {
+#if IPC_CALL_METRICS
+      auto& registry = Instance();
+
+      std::lock_guard<std::mutex> lock(registry.mutex);
+
+      std::vector<FunctionMetrics> ret(registry.names.size());
+      for (size_t i = 0; i < ret.size(); i++) {
+        ret[i].name = registry.names[i];
+      }
+
+      registry.retired.MergeInto(ret);
+
+      for (const auto& thread : registry.threads) {
+        thread->MergeInto(ret);
+      }
+
+      return ret;
+#else
+      return {};
+#endif
+    }
+
+    // Index of the counters of 'funcName', it is called by 'Server::Functions::RegisterFunc'.
+    static size_t Register(const std::string& funcName) {
+#if IPC_CALL_METRICS
+      auto& registry = Instance();
+
+      std::lock_guard<std::mutex> lock(registry.mutex);
+
+      const auto it = std::find(registry.names.begin(), registry.names.end(), funcName);
+      if (it != registry.names.end()) {
+        return it - registry.names.begin();
+      }
+
+      registry.names.push_back(funcName);
+
+      return registry.names.size() - 1;
+#else
+      (void)funcName;
+      return 0;
+#endif
+    }
+
+#if IPC_CALL_METRICS
+  private:
+    // Only the owner thread writes a counter, so it is incremented without a locked instruction.
+    static void Add(std::atomic<uint64_t>& counter, uint64_t n) {
+      counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static uint64_t Now() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Histogram {
+      void Record(uint64_t ns) {
+        Add(counts[LatencyHistogram::Bucket(ns)], 1);
+        Add(sum, ns);
+      }
+
+      void MergeInto(LatencyHistogram& histogram) const {
+        for (size_t i = 0; i < LatencyHistogram::BucketCount; i++) {
+          histogram.counts[i] += counts[i].load(std::memory_order_relaxed);
+        }
+
+        histogram.sum += sum.load(std::memory_order_relaxed);
+      }
+
+      void MergeInto(Histogram& histogram) const {
+        for (size_t i = 0; i < LatencyHistogram::BucketCount; i++) {
+          Add(histogram.counts[i], counts[i].load(std::memory_order_relaxed));
+        }
+
+        Add(histogram.sum, sum.load(std::memory_order_relaxed));
+      }
+
+      std::array<std::atomic<uint64_t>, LatencyHistogram::BucketCount> counts{};
+      std::atomic<uint64_t> sum{0};
+    };
+
+    // Counters of a function on a thread.
+    struct Counters {
+      template <typename T>
+      void MergeInto(T& to) const {
+        Merge(calls, to.calls);
+        Merge(errors, to.errors);
+        Merge(requestBytes, to.requestBytes);
+        Merge(replyBytes, to.replyBytes);
+        Merge(cacheHits, to.cacheHits);
+        Merge(cacheMisses, to.cacheMisses);
+        Merge(expired, to.expired);
+
+        decode.MergeInto(to.decode);
+        execute.MergeInto(to.execute);
+        encode.MergeInto(to.encode);
+      }
+
+      static void Merge(const std::atomic<uint64_t>& from, uint64_t& to) {
+        to += from.load(std::memory_order_relaxed);
+      }
+
+      static void Merge(const std::atomic<uint64_t>& from, std::atomic<uint64_t>& to) {
+        Add(to, from.load(std::memory_order_relaxed));
+      }
+
+      std::atomic<uint64_t> calls{0};
+      std::atomic<uint64_t> errors{0};
+      std::atomic<uint64_t> requestBytes{0};
+      std::atomic<uint64_t> replyBytes{0};
+      std::atomic<uint64_t> cacheHits{0};
+      std::atomic<uint64_t> cacheMisses{0};
+      std::atomic<uint64_t> expired{0};
+
+      Histogram decode;
+      Histogram execute;
+      Histogram encode;
+    };
+
+    struct ThreadCounters {
+      Counters& Get(size_t index) {
+        if (index < functions.size() && functions[index]) {
+          return *functions[index];
+        }
+
+        // 'Snapshot' reads 'functions' of other threads under 'mutex'.
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (index >= functions.size()) {
+          functions.resize(index + 1);
+        }
+
+        functions[index] = std::make_unique<Counters>();
+
+        return *functions[index];
+      }
+
+      template <typename T>
+      void MergeInto(std::vector<T>& to) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (size_t i = 0; i < functions.size() && i < to.size(); i++) {
+          if (functions[i]) {
+            functions[i]->MergeInto(to[i]);
+          }
+        }
+      }
+
+      std::mutex mutex;
+      std::vector<std::unique_ptr<Counters>> functions;
+      uint32_t calls = 0; // For sampling.
+    };
+
+    struct Registry {
+      // Counters of an exited thread are added to 'retired'.
+      void Retire(const std::shared_ptr<ThreadCounters>& thread) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::vector<Counters*> to;
+        for (size_t i = 0; i < thread->functions.size(); i++) {
+          to.push_back(thread->functions[i] ? &retired.Get(i) : nullptr);
+        }
+
+        for (size_t i = 0; i < to.size(); i++) {
+          if (to[i] != nullptr) {
+            thread->functions[i]->MergeInto(*to[i]);
+          }
+        }
+
+        threads.erase(std::find(threads.begin(), threads.end(), thread));
+      }
+
+      std::mutex mutex;
+      std::vector<std::string> names;
+      std::vector<std::shared_ptr<ThreadCounters>> threads;
+      ThreadCounters retired;
+    };
+
+    static Registry& Instance() {
+      static Registry s_registry;
+      return s_registry;
+    }
+
+    // Counters of the current thread.
+    static ThreadCounters& Local() {
+      static thread_local ThreadCounters* s_local = nullptr;
+
+      if (s_local == nullptr) {
+        s_local = &Attach();
+      }
+
+      return *s_local;
+    }
+
+    // Counters of the current thread are added to the registry on its first call, and retired when it exits.
+    static ThreadCounters& Attach() {
+      struct Attached {
+        Attached() {
+          auto& registry = Instance();
+
+          std::lock_guard<std::mutex> lock(registry.mutex);
+          registry.threads.push_back(counters);
+        }
+
+        ~Attached() {
+          Instance().Retire(counters);
+        }
+
+        std::shared_ptr<ThreadCounters> counters = std::make_shared<ThreadCounters>();
+      };
+
+      static thread_local Attached s_attached;
+
+      return *s_attached.counters;
+    }
+#endif
+
+  public:
+    // Records a call of a function on the server, it is created before its parameters are decoded.
+    // The call is counted as an error if it is destroyed before 'Executed' (an asynchronous call) or 'Replied'.
+    struct Call {
+#if IPC_CALL_METRICS
+      Call(size_t index, size_t requestBytes) : Call(Local(), index, requestBytes) {}
+
+      Call(const Call&) = delete;
+      Call& operator=(const Call&) = delete;
+
+      ~Call() {
+        if (!done_) {
+          Add(counters_.errors, 1);
+        }
+      }
+
+      void Decoded() {
+        if (timed_) {
+          decoded_ = Now();
+        }
+      }
+
+      // A call without a reply is done when it is executed.
+      void Executed(bool reply = true) {
+        if (timed_) {
+          executed_ = Now();
+
+          counters_.decode.Record(decoded_ - start_);
+          counters_.execute.Record(executed_ - decoded_);
+        }
+
+        done_ = !reply;
+      }
+
+      // The reply is from the cache, phases of the call are not timed.
+      void CacheHit() {
+        Add(counters_.cacheHits, 1);
+
+        timed_ = false;
+      }
+
+      void CacheMiss() {
+        Add(counters_.cacheMisses, 1);
+      }
+
+      // The deadline of the call expired, it is not an error of the function.
+      void Expired() {
+        Add(counters_.expired, 1);
+
+        done_ = true;
+      }
+
+      void Replied(size_t replyBytes) {
+        Add(counters_.replyBytes, replyBytes);
+
+        if (timed_) {
+          counters_.encode.Record(Now() - executed_);
+        }
+
+        done_ = true;
+      }
+
+    private:
+      Call(ThreadCounters& local, size_t index, size_t requestBytes) :
+        counters_(local.Get(index)), timed_(local.calls++ % IPC_CALL_METRICS_SAMPLING == 0) {
+        Add(counters_.calls, 1);
+        Add(counters_.requestBytes, requestBytes);
+
+        if (timed_) {
+          start_ = Now();
+        }
+      }
+
+      Counters& counters_;
+      bool timed_;
+      bool done_ = false;
+
+      uint64_t start_ = 0;
+      uint64_t decoded_ = 0;
+      uint64_t executed_ = 0;
+#else
+      Call(size_t, size_t) {}
+
+      void Decoded() {}
+      void Executed(bool = true) {}
+      void CacheHit() {}
+      void CacheMiss() {}
+      void Expired() {}
+      void Replied(size_t) {}
+#endif
+    };
+  };
+}
+
+// Metrics of the server, the server registers it when 'IPC_CALL_METRICS' is not 0.
+inline std::vector<IpcCall::FunctionMetrics> IpcCallMetrics() {
+  return IpcCall::Metrics::Snapshot();
+}
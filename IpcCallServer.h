@@ -1,22 +1,63 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <utility>
 #include <stdexcept>
+#include <thread>
 
+#include "IpcCallCache.h"
 #include "IpcCallData.h"
+#include "IpcCallMetrics.h"
+#include "IpcCallStream.h"
 
 namespace IpcCall {
+  // What happens to a call that arrives when its queue is full, see 'Limits'.
+  enum class Overload {
+    Reject,     // The call fails with 'Overloaded'.
+    DropOldest, // The oldest queued call fails with 'Overloaded', the call is queued.
+    Block,      // The transport thread that submits the call waits until the queue has space.
+  };
+
+  // Admission limits of the calls of a function that are executed by 'Dispatcher', see 'IpcCallDispatcher.h'.
+  // A call is in flight from its admission until it completes, calls over 'maxInFlight' wait in a queue of 'maxQueued'.
+  struct Limits {
+    static constexpr size_t Unlimited = SIZE_MAX;
+
+    size_t maxInFlight = Unlimited;
+    size_t maxQueued = Unlimited;
+    Overload overload = Overload::Reject;
+  };
+
+  // Error of a call that is rejected or dropped by admission.
+  struct Overloaded: std::runtime_error {
+    Overloaded() : std::runtime_error("IPC server is overloaded, the call is not executed") {}
+  };
+
   struct Server {
+    // An argument of a parameter by value or by rvalue reference is moved into the call.
+    template <typename Param, typename T>
+    static decltype(auto) PassArg(T& arg) {
+      if constexpr (std::is_lvalue_reference_v<Param>) {
+        return (arg);
+      } else {
+        return std::move(arg);
+      }
+    }
+
     template <typename Ret, typename F, typename Tuple, int Index, typename ...Args>
-    static void UnserializeCallSerialize(F f, Serializer& serializer, Unserializer& unserializer, Args&&...args) {
+    static void UnserializeCallSerialize(F f, Serializer& serializer, Unserializer& unserializer, Metrics::Call& call, Args&&...args) {
       if constexpr (Index < std::tuple_size_v<Tuple>) {
         using param_t = decltype(std::get<Index>(std::declval<Tuple>()));
 
         std::decay_t<param_t> arg;
         unserializer >> arg;
 
-        UnserializeCallSerialize<Ret, F, Tuple, Index + 1, Args...>(f, serializer, unserializer, std::forward<Args>(args)..., arg);
+        UnserializeCallSerialize<Ret, F, Tuple, Index + 1, Args...>(f, serializer, unserializer, call, std::forward<Args>(args)..., PassArg<param_t>(arg));
 
         // If 'out' parameter, serialized in reversed order. 
         if constexpr (IsOutParam<param_t>())
@@ -25,67 +66,175 @@ namespace IpcCall {
         }
       }
       else {
+        // Reserve the reply once for the return and 'out' parameters.
+        const auto format = serializer.GetFormat();
+
+        call.Decoded();
+
         if constexpr (std::is_void_v<Ret>) {
           f(std::forward<Args>(args)...);
+
+          call.Executed();
+
+          ExpireReply(call);
+
+          serializer.Reserve(OutParamsSize<Tuple>(format, std::index_sequence_for<Args...>(), args...));
         }
         else {
-          serializer << f(std::forward<Args>(args)...);
+          const auto& ret = f(std::forward<Args>(args)...);
+
+          call.Executed();
+
+          ExpireReply(call);
+
+          serializer.Reserve(SizeOf(ret, format) + OutParamsSize<Tuple>(format, std::index_sequence_for<Args...>(), args...));
+
+          serializer << ret;
         }
       }
     }
 
+    // The reply of a call after its deadline is not serialized, the function is executed in the scope of the deadline.
+    static void ExpireReply(Metrics::Call& call) {
+      if (Deadline::Expired(Deadline::Current())) {
+        call.Expired();
+        throw DeadlineExceeded();
+      }
+    }
+
+    // An expired request is dropped before its parameters are unserialized, 'deadline' is set for the execution.
+    // The time that is left of the request is counted from 'received'.
+    static bool Expire(const Header& header, Deadline::Clock::time_point received, Metrics::Call& call, std::optional<Deadline>& deadline) {
+      if (!(header.flags & HasDeadline)) {
+        return false;
+      }
+
+      const auto end = received + std::chrono::duration_cast<Deadline::Clock::duration>(std::chrono::nanoseconds(header.deadline));
+      if (Deadline::Clock::now() >= end) {
+        call.Expired();
+        return true;
+      }
+
+      deadline.emplace(end);
+
+      return false;
+    }
+
+    template <typename Tuple, size_t ...Indexes, typename ...Args>
+    static size_t OutParamsSize([[maybe_unused]] Format format, std::index_sequence<Indexes...>, const Args&...args) {
+      return (0 + ... + (IsOutParam<std::tuple_element_t<Indexes, Tuple>>() ? SizeOf(args, format) : 0));
+    }
+
     template <typename F, typename Tuple, int Index, typename ...Args>
-    static void UnserializeCall(F f, Unserializer& unserializer, Args&&...args) {
+    static void UnserializeCall(F f, Unserializer& unserializer, Metrics::Call& call, Args&&...args) {
       if constexpr (Index < std::tuple_size_v<Tuple>) {
         using param_t = decltype(std::get<Index>(std::declval<Tuple>()));
 
         std::decay_t<param_t> arg;
         unserializer >> arg;
 
-        UnserializeCall<F, Tuple, Index + 1, Args...>(f, unserializer, std::forward<Args>(args)..., arg);
+        UnserializeCall<F, Tuple, Index + 1, Args...>(f, unserializer, call, std::forward<Args>(args)..., PassArg<param_t>(arg));
       } else {
+          call.Decoded();
+
           f(std::forward<Args>(args)...);
+
+          call.Executed(false);
       }
     }
 
     struct IFunction
     {
-      virtual bytes_t SyncCall(Unserializer& unserializer) const = 0;
-      virtual void AsyncCall(Unserializer& unserializer) const = 0;
+      // 'received' is when the transport received the request, see 'Expire'.
+      virtual bytes_t SyncCall(Unserializer& unserializer, const Header& header, Deadline::Clock::time_point received) const = 0;
+      virtual void AsyncCall(Unserializer& unserializer, const Header& header, Deadline::Clock::time_point received) const = 0;
       virtual ~IFunction() = default;
+
+      // Limits of registration, applied by 'Dispatcher'.
+      Limits limits;
     };
 
     template <typename F>
     struct Function: public IFunction
     {
-      Function(F f) :f_(f) {}
+      Function(F f, size_t metricsIndex, std::unique_ptr<ResultCache> cache = nullptr) :
+        f_(f), metricsIndex_(metricsIndex), cache_(std::move(cache)) {}
+
+      bytes_t SyncCall(Unserializer& unserializer, const Header& header, Deadline::Clock::time_point received) const override {
+        Metrics::Call call(metricsIndex_, unserializer.Available());
+
+        std::optional<Deadline> deadline;
+        if (Expire(header, received, call, deadline)) {
+          throw DeadlineExceeded();
+        }
+
+        // Reply has the format and the encoding of the request, 'OutStream' return is sent on the channel of the request.
+        Serializer serializer(BufferPool::Acquire(), unserializer.GetFormat());
+        serializer.SetCompact(unserializer.IsCompact());
+        serializer.SetChannel(unserializer.GetChannel());
+
+        // Reply of a pipelined call starts with its ID, it is not a varint, see 'ReplyCallId'.
+        if (header.flags & HasCallId) {
+          serializer.Serialize(header.callId);
+        }
+
+        if (!cache_) {
+          return SyncCall(f_, serializer, unserializer, call);
+        }
+
+        // The key is a view of the request, it is valid until the call returns.
+        const auto key = ResultCache::Key::Of(unserializer, serializer.Bytes().size());
+
+        if (cache_->Find(key, serializer)) {
+          call.CacheHit();
+          call.Replied(serializer.Bytes().size());
 
-      bytes_t SyncCall(Unserializer& unserializer) const override {
-        Serializer serializer;
+          return serializer.Release();
+        }
+
+        call.CacheMiss();
+
+        const size_t replyStart = serializer.Bytes().size();
 
-        return SyncCall(f_, serializer, unserializer);
+        auto reply = SyncCall(f_, serializer, unserializer, call);
+
+        cache_->Insert(key, reply.data() + replyStart, reply.size() - replyStart);
+
+        return reply;
       }
 
       template <typename Ret, typename ...Params>
-      bytes_t SyncCall(Ret(*)(Params...), Serializer& serializer, Unserializer& unserializer) const
+      bytes_t SyncCall(Ret(*)(Params...), Serializer& serializer, Unserializer& unserializer, Metrics::Call& call) const
       {
-        UnserializeCallSerialize<Ret, F, std::tuple<Params...>, 0>(f_, serializer, unserializer);
+        UnserializeCallSerialize<Ret, F, std::tuple<Params...>, 0>(f_, serializer, unserializer, call);
+
+        call.Replied(serializer.Bytes().size());
 
-        return serializer.Bytes();
+        return serializer.Release();
       }
 
-      void AsyncCall(Unserializer& unserializer) const override {
-        AsyncCall(f_, unserializer);
+      void AsyncCall(Unserializer& unserializer, const Header& header, Deadline::Clock::time_point received) const override {
+        Metrics::Call call(metricsIndex_, unserializer.Available());
+
+        // There is no one to report an expired asynchronous call to.
+        std::optional<Deadline> deadline;
+        if (Expire(header, received, call, deadline)) {
+          return;
+        }
+
+        AsyncCall(f_, unserializer, call);
       }
 
       template <typename Ret, typename ...Params>
-      void AsyncCall(Ret(*)(Params...), Unserializer& unserializer) const
+      void AsyncCall(Ret(*)(Params...), Unserializer& unserializer, Metrics::Call& call) const
       {
-        UnserializeCall<F, std::tuple<Params...>, 0>(f_, unserializer);
+        UnserializeCall<F, std::tuple<Params...>, 0>(f_, unserializer, call);
       }
 
     private:
       F f_;
+      size_t metricsIndex_;
+      std::unique_ptr<ResultCache> cache_;
     };
 
     struct Functions {
@@ -95,14 +244,37 @@ namespace IpcCall {
       }
 
       template <typename Ret, typename ...Params>
-      bool RegisterFunc(const std::string& funcName, Ret(*f)(Params...))
+      bool RegisterFunc(const std::string& funcName, Ret(*f)(Params...), std::unique_ptr<ResultCache> cache = nullptr, const Limits& limits = {})
       {
-        mapNameFunction_[funcName] = std::make_unique<Function<decltype(f)>>(f);
+        const auto it = mapNameFunction_.try_emplace(funcName).first;
+        it->second = std::make_unique<Function<decltype(f)>>(f, Metrics::Register(funcName), std::move(cache));
+        it->second->limits = limits;
+
+        try {
+          InsertId(FunctionId(it->first), it->first, it->second.get());
+        } catch (...) {
+          mapNameFunction_.erase(it);
+          throw;
+        }
 
         return true;
       }
 
-      IFunction* FindFunction(const std::string& funcName) {
+      // 'f' should be pure, its reply is cached by its arguments, see 'IpcCallCache.h'.
+      template <typename Ret, typename ...Params>
+      bool RegisterCachedFunc(const std::string& funcName, Ret(*f)(Params...), size_t capacity, ResultCache::Clock::duration ttl)
+      {
+        static_assert(!IsStreamingCall<Ret, Params...>(), "A function with streams can't be cached");
+
+        return RegisterFunc(funcName, f, std::make_unique<ResultCache>(capacity, ttl));
+      }
+
+      // Registered functions by name.
+      const std::map<std::string, std::unique_ptr<IFunction>, std::less<>>& All() const {
+        return mapNameFunction_;
+      }
+
+      IFunction* FindFunction(std::string_view funcName) const {
         auto it = mapNameFunction_.find(funcName);
         if (it == mapNameFunction_.end()) {
           return nullptr;
@@ -111,37 +283,373 @@ namespace IpcCall {
         return it->second.get();
       }
 
+      IFunction* FindFunction(func_id_t funcId) const {
+        if (idSlots_.empty()) {
+          return nullptr;
+        }
+
+        for (size_t i = funcId & (idSlots_.size() - 1); ; i = (i + 1) & (idSlots_.size() - 1)) {
+          const auto& slot = idSlots_[i];
+
+          if (slot.pFunc == nullptr || slot.funcId == funcId) {
+            return slot.pFunc;
+          }
+        }
+      }
+
     private:
-      std::map<std::string, std::unique_ptr<IFunction>> mapNameFunction_;
+      // Slot of the open addressing table of function IDs.
+      struct IdSlot {
+        func_id_t funcId = 0;
+        IFunction* pFunc = nullptr;
+        const std::string* pFuncName = nullptr;
+      };
+
+      void InsertId(func_id_t funcId, const std::string& funcName, IFunction* pFunc) {
+        // Keep the load factor at most 1/2.
+        if (2 * (idCount_ + 1) > idSlots_.size()) {
+          auto idSlots = std::move(idSlots_);
+
+          idSlots_.assign(std::max<size_t>(16, 2 * idSlots.size()), {});
+          idCount_ = 0;
+
+          for (const auto& slot : idSlots) {
+            if (slot.pFunc != nullptr) {
+              InsertId(slot.funcId, *slot.pFuncName, slot.pFunc);
+            }
+          }
+        }
+
+        for (size_t i = funcId & (idSlots_.size() - 1); ; i = (i + 1) & (idSlots_.size() - 1)) {
+          auto& slot = idSlots_[i];
+
+          if (slot.pFunc == nullptr) {
+            slot = { funcId, pFunc, &funcName };
+            idCount_++;
+
+            return;
+          }
+
+          if (slot.funcId == funcId) {
+            if (*slot.pFuncName != funcName) {
+              throw std::logic_error("IPC functions '" + *slot.pFuncName + "' and '" + funcName + "' have the same ID, one of them should be renamed");
+            }
+
+            slot.pFunc = pFunc;
+
+            return;
+          }
+        }
+      }
+
+      std::map<std::string, std::unique_ptr<IFunction>, std::less<>> mapNameFunction_;
+
+      std::vector<IdSlot> idSlots_;
+      size_t idCount_ = 0;
     };
 
+    // Returns nullptr for a batch, its calls can be of different functions.
     static IFunction* FindFunction(Unserializer& unserializer) {
-      std::string funcName;
+      Header header;
+      unserializer >> header;
+
+      if (header.flags & IsBatch) {
+        return nullptr;
+      }
+
+      return FindFunction(unserializer, header);
+    }
+
+    // 'header' of the request is already unserialized.
+    static IFunction* FindFunction(Unserializer& unserializer, const Header& header) {
+      if (header.flags & HasFunctionId) {
+        func_id_t funcId;
+        unserializer.Unserialize(funcId);
+
+        const auto pFunc = Functions::Instance().FindFunction(funcId);
+
+        if (pFunc == nullptr) {
+          throw std::runtime_error("IPC function ID " + std::to_string(funcId) + " is not registered");
+        }
+
+        return pFunc;
+      }
+
+      std::string_view funcName;
       unserializer >> funcName;
 
       const auto pFunc = Functions::Instance().FindFunction(funcName);
 
       if (pFunc == nullptr) {
-        throw std::runtime_error("IPC function '" + funcName + "' is no registered");
+        throw std::runtime_error("IPC function '" + std::string(funcName) + "' is not registered");
       }
 
       return pFunc; 
     }
         
+    // Records the requests that reach 'SyncCall', 'AsyncCall' and 'BatchCall', for instance 'Capture' in 'IpcCallCapture.h'.
+    // A batch is recorded once, not its calls. It is called on the thread of the call, after the call.
+    struct IRecorder {
+      virtual void Record(const bytes_t& request, bool sync, std::chrono::steady_clock::time_point start,
+                          std::chrono::nanoseconds latency, size_t replyBytes, bool failed) = 0;
+      virtual ~IRecorder() = default;
+    };
+
+    // 'recorder' is nullptr to stop recording. It returns after the calls of 'Record' of the previous recorder return,
+    // then it can be destroyed.
+    static void SetRecorder(IRecorder* recorder) {
+      Recorder().store(recorder);
+      WaitRecording();
+    }
+
+    // Stops recording if 'recorder' is set, and waits for its calls of 'Record' as 'SetRecorder'.
+    static void RemoveRecorder(IRecorder* recorder) {
+      Recorder().compare_exchange_strong(recorder, nullptr);
+      WaitRecording();
+    }
+
     // It should be called by the server IPC transport with the 'bytes' that are received from the client.
-    static std::vector<uint8_t> SyncCall(const std::vector<uint8_t>& bytes) {
-      Unserializer unserializer(bytes);
+    // After the reply is sent, the transport can return it to 'BufferPool::Release' to be reused.
+    // 'received' is when the request was received, the deadline of the request is counted from it.
+    static std::vector<uint8_t> SyncCall(const std::vector<uint8_t>& bytes, Deadline::Clock::time_point received = Deadline::Clock::now()) {
+      if (Recorder().load(std::memory_order_relaxed)) {
+        return Recorded(bytes, true, [&] { return Sync(bytes, received); });
+      }
 
-      return FindFunction(unserializer)->SyncCall(unserializer);
+      return Sync(bytes, received);
     }
 
     // It should be called by the server IPC transport with the 'bytes' that are received from the client.
-    static void AsyncCall(const std::vector<uint8_t>& bytes) {
+    static void AsyncCall(const std::vector<uint8_t>& bytes, Deadline::Clock::time_point received = Deadline::Clock::now()) {
+      if (Recorder().load(std::memory_order_relaxed)) {
+        Recorded(bytes, false, [&] { Async(bytes, received); return bytes_t(); });
+        return;
+      }
+
+      Async(bytes, received);
+    }
+
+  private:
+    static std::atomic<IRecorder*>& Recorder() {
+      static std::atomic<IRecorder*> s_recorder{nullptr};
+      return s_recorder;
+    }
+
+    // Calls of 'IRecorder::Record' in progress, a thread counts its calls in one of the slots, so threads rarely contend.
+    struct alignas(64) RecordingSlot {
+      std::atomic<uint32_t> count{0};
+    };
+
+    static constexpr size_t RecordingSlots = 16;
+
+    static std::array<RecordingSlot, RecordingSlots>& Recording() {
+      static std::array<RecordingSlot, RecordingSlots> s_recording;
+      return s_recording;
+    }
+
+    // The recorder is loaded after the slot of the thread is incremented, and 'SetRecorder' checks the slots after
+    // it stores the recorder, so either the call sees the new recorder, or 'WaitRecording' sees the call.
+    static void Record(const bytes_t& request, bool sync, std::chrono::steady_clock::time_point start, size_t replyBytes, bool failed) {
+      static std::atomic<size_t> s_nextSlot{0};
+      static thread_local RecordingSlot& t_slot = Recording()[s_nextSlot.fetch_add(1, std::memory_order_relaxed) % RecordingSlots];
+
+      t_slot.count.fetch_add(1);
+
+      if (const auto recorder = Recorder().load()) {
+        recorder->Record(request, sync, start, std::chrono::steady_clock::now() - start, replyBytes, failed);
+      }
+
+      t_slot.count.fetch_sub(1, std::memory_order_release);
+    }
+
+    static void WaitRecording() {
+      for (auto& slot : Recording()) {
+        while (slot.count.load() != 0) {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    template <typename F>
+    static bytes_t Recorded(const bytes_t& request, bool sync, F&& f) {
+      const auto start = std::chrono::steady_clock::now();
+
+      try {
+        auto reply = f();
+
+        Record(request, sync, start, reply.size(), false);
+
+        return reply;
+      } catch (...) {
+        Record(request, sync, start, 0, true);
+        throw;
+      }
+    }
+
+    static bytes_t Sync(const bytes_t& bytes, Deadline::Clock::time_point received) {
+      Unserializer unserializer(bytes);
+
+      Header header;
+      unserializer >> header;
+
+      if (header.flags & IsBatch) {
+        return BatchCall(unserializer, header, true, received);
+      }
+
+      return FindFunction(unserializer, header)->SyncCall(unserializer, header, received);
+    }
+
+    static void Async(const bytes_t& bytes, Deadline::Clock::time_point received) {
+      Unserializer unserializer(bytes);
+
+      Header header;
+      unserializer >> header;
+
+      if (header.flags & IsBatch) {
+        BufferPool::Release(BatchCall(unserializer, header, false, received));
+        return;
+      }
+
+      FindFunction(unserializer, header)->AsyncCall(unserializer, header, received);
+    }
+
+  public:
+    // It should be called by the server IPC transport with 'FrameKind::StreamRequest' 'bytes' that are received on 'channel',
+    // 'InStream' parameter is received from 'channel', then the reply and 'OutStream' return are sent on it.
+    static void StreamCall(const std::vector<uint8_t>& bytes, StreamChannel& channel) {
+      const auto received = Deadline::Clock::now();
+
+      bytes_t reply;
+      std::string error;
+
+      try {
+        Unserializer unserializer(bytes);
+        unserializer.SetChannel(&channel);
+
+        Header header;
+        unserializer >> header;
+
+        reply = FindFunction(unserializer, header)->SyncCall(unserializer, header, received);
+      } catch (const std::exception& e) {
+        error = e.what();
+      }
+
+      channel.DrainInput();
+
+      if (!error.empty()) {
+        channel.output = nullptr;
+        channel.Write(FrameKind::Error, bytes_t(error.begin(), error.end()));
+        return;
+      }
+
+      channel.Write(FrameKind::Reply, reply);
+      BufferPool::Release(std::move(reply));
+
+      if (channel.output) {
+        const auto output = std::move(channel.output);
+        channel.output = nullptr;
+
+        // The client receives the error instead of the rest of the stream.
+        try {
+          output(channel);
+        } catch (const std::exception& e) {
+          error = e.what();
+          channel.Write(FrameKind::Error, bytes_t(error.begin(), error.end()));
+        }
+      }
+    }
+
+    // Calls of a batch that is sent by 'IpcCall::Batch', 'SyncCall' and 'AsyncCall' call it for a batch.
+    // Returns the replies of its synchronous calls in their order, an exception of a call is returned
+    // as its reply, so it doesn't affect the other calls.
+    static std::vector<uint8_t> BatchCall(const std::vector<uint8_t>& bytes, Deadline::Clock::time_point received = Deadline::Clock::now()) {
+      if (Recorder().load(std::memory_order_relaxed)) {
+        return Recorded(bytes, true, [&] { return Batch(bytes, received); });
+      }
+
+      return Batch(bytes, received);
+    }
+
+  private:
+    static bytes_t Batch(const bytes_t& bytes, Deadline::Clock::time_point received) {
       Unserializer unserializer(bytes);
 
-      FindFunction(unserializer)->AsyncCall(unserializer);
+      Header header;
+      unserializer >> header;
+
+      if (!(header.flags & IsBatch)) {
+        throw std::runtime_error("IPC request is not a batch");
+      }
+
+      return BatchCall(unserializer, header, true, received);
+    }
+
+    // Every call of the batch is a flag if it is synchronous and its request.
+    // Every reply is a flag if the call failed, and its reply or the text of its exception.
+    // The deadlines of all calls are counted from 'received' of the batch.
+    static bytes_t BatchCall(Unserializer& unserializer, const Header& header, bool sync, Deadline::Clock::time_point received) {
+      Serializer serializer(BufferPool::Acquire(), header.format);
+      serializer.SetCompact(header.flags & Compact);
+
+      auto request = BufferPool::Acquire();
+
+      while (unserializer.Available()) {
+        bool syncCall;
+        unserializer >> syncCall >> request;
+
+        if (!syncCall) {
+          // There is no one to report an error of an asynchronous call to.
+          try {
+            Async(request, received);
+          } catch (...) {
+          }
+
+          continue;
+        }
+
+        bytes_t reply;
+        std::string error;
+
+        try {
+          reply = Sync(request, received);
+        } catch (const std::exception& e) {
+          error = e.what();
+        } catch (...) {
+          error = "IPC server error";
+        }
+
+        if (sync) {
+          serializer << !error.empty();
+
+          if (error.empty()) {
+            serializer << reply;
+          } else {
+            serializer << error;
+          }
+        }
+
+        BufferPool::Release(std::move(reply));
+      }
+
+      BufferPool::Release(std::move(request));
+
+      return serializer.Release();
     }
   };
 }
 
 #define IPC_CALL_REGISTER(f) static auto f##IpcRegisterFunction = IpcCall::Server::Functions::Instance().RegisterFunc(#f, f)
+
+// 'f' is a pure function, up to 'capacity' replies are cached for 'ttl' (a 'std::chrono' duration, 0 doesn't expire).
+#define IPC_CALL_REGISTER_CACHED(f, capacity, ttl) \
+  static auto f##IpcRegisterFunction = IpcCall::Server::Functions::Instance().RegisterCachedFunc(#f, f, capacity, ttl)
+
+// Calls of 'f' that are executed by 'Dispatcher' are admitted by 'IpcCall::Limits', the arguments are its fields
+// 'maxInFlight', 'maxQueued' and 'overload', e.g. 'IPC_CALL_REGISTER_LIMITED(f, 4, 100, IpcCall::Overload::DropOldest)'.
+#define IPC_CALL_REGISTER_LIMITED(f, ...) \
+  static auto f##IpcRegisterFunction = IpcCall::Server::Functions::Instance().RegisterFunc(#f, f, nullptr, IpcCall::Limits{ __VA_ARGS__ })
+
+#if IPC_CALL_METRICS
+// Built-in function that returns the metrics of the server, see 'IpcCallMetrics.h'.
+inline const bool IpcCallMetricsIpcRegisterFunction = IpcCall::Server::Functions::Instance().RegisterFunc("IpcCallMetrics", IpcCallMetrics);
+#endif
@@ -0,0 +1,482 @@
+// Shared memory IPC transport for a client and a server on the same host (Linux).
+//
+// A channel is a POSIX shared memory object with two single-producer single-consumer byte rings,
+// requests from the client to the server and replies from the server to the client.
+// A waiting side spins 'spinCount' times (low-latency mode) and then sleeps on a futex.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <climits>
+
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "IpcCallServer.h"
+#include "IpcCallFrame.h"
+
+namespace IpcCall {
+  // Thrown when the other side closes the channel or exits.
+  struct ShmClosed: std::runtime_error {
+    ShmClosed() : std::runtime_error("IPC shared memory channel is closed") {}
+  };
+
+  inline void FutexWait(std::atomic<uint32_t>& value, uint32_t expected, const timespec* timeout) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAIT, expected, timeout, nullptr, 0);
+  }
+
+  inline void FutexWake(std::atomic<uint32_t>& value) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+  }
+
+  inline void SpinPause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  // Single-producer single-consumer byte ring, 'Control' and data are in shared memory.
+  struct ShmRing {
+    struct Control {
+      alignas(64) std::atomic<uint64_t> head; // Written by the producer.
+      std::atomic<uint32_t> dataSeq;
+      std::atomic<uint32_t> consumerWaiting;
+
+      alignas(64) std::atomic<uint64_t> tail; // Written by the consumer.
+      std::atomic<uint32_t> spaceSeq;
+      std::atomic<uint32_t> producerWaiting;
+    };
+
+    // Spinning only delays the other side if there is a single CPU.
+    ShmRing(Control* control, uint8_t* data, size_t capacity, std::atomic<uint32_t>* closed, std::atomic<int32_t>* peerPid, unsigned spinCount) :
+      control_(control), data_(data), capacity_(capacity), closed_(closed), peerPid_(peerPid),
+      spinCount_(std::thread::hardware_concurrency() > 1 ? spinCount : 0), head_(control->head.load()) {}
+
+    // Producer: copies 'size' bytes into the ring, waiting for space if needed.
+    // The bytes are visible to the consumer after a 'Write' with 'publish'.
+    void Write(const void* data, size_t size, bool publish) {
+      auto src = static_cast<const uint8_t*>(data);
+
+      while (size) {
+        size_t free = capacity_ - (head_ - control_->tail.load(std::memory_order_acquire));
+        if (free == 0) {
+          Publish();
+
+          if (!Wait(control_->spaceSeq, control_->producerWaiting, [&] { return control_->tail.load() != head_ - capacity_; })) {
+            throw ShmClosed();
+          }
+
+          continue;
+        }
+
+        const size_t n = std::min(size, free);
+        CopyIn(head_, src, n);
+
+        head_ += n;
+        src += n;
+        size -= n;
+      }
+
+      if (publish) {
+        Publish();
+      }
+    }
+
+    // Consumer: copies 'size' bytes from the ring, waiting for data if needed.
+    void Read(void* data, size_t size) {
+      auto dst = static_cast<uint8_t*>(data);
+
+      while (size) {
+        const uint64_t tail = control_->tail.load(std::memory_order_relaxed);
+
+        size_t available = control_->head.load(std::memory_order_acquire) - tail;
+        if (available == 0) {
+          if (!Wait(control_->dataSeq, control_->consumerWaiting, [&] { return control_->head.load() != tail; })) {
+            throw ShmClosed();
+          }
+
+          continue;
+        }
+
+        const size_t n = std::min(size, available);
+        CopyOut(dst, tail, n);
+
+        control_->tail.store(tail + n);
+        Notify(control_->spaceSeq, control_->producerWaiting);
+
+        dst += n;
+        size -= n;
+      }
+    }
+
+    // Wakes both sides, after the channel is closed.
+    void WakeAll() {
+      control_->dataSeq.fetch_add(1);
+      FutexWake(control_->dataSeq);
+
+      control_->spaceSeq.fetch_add(1);
+      FutexWake(control_->spaceSeq);
+    }
+
+  private:
+    void Publish() {
+      if (control_->head.load(std::memory_order_relaxed) != head_) {
+        control_->head.store(head_);
+        Notify(control_->dataSeq, control_->consumerWaiting);
+      }
+    }
+
+    // 'seq' is incremented on every change, a sleeping side is woken only if it set 'waiting'.
+    static void Notify(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting) {
+      seq.fetch_add(1);
+
+      if (waiting.load()) {
+        FutexWake(seq);
+      }
+    }
+
+    // Returns false if the channel is closed or the other side exits before 'ready()'.
+    template <typename Ready>
+    bool Wait(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting, Ready ready) {
+      for (unsigned i = 0; i < spinCount_; i++) {
+        if (ready()) {
+          return true;
+        }
+
+        SpinPause();
+      }
+
+      while (true) {
+        const uint32_t value = seq.load();
+
+        waiting.store(1);
+
+        if (ready()) {
+          waiting.store(0);
+          return true;
+        }
+
+        if (closed_->load() || !PeerAlive()) {
+          waiting.store(0);
+          return false;
+        }
+
+        // Wake up periodically to check that the other side is alive.
+        const timespec timeout = { 0, 100'000'000 };
+        FutexWait(seq, value, &timeout);
+      }
+    }
+
+    bool PeerAlive() const {
+      const pid_t pid = peerPid_->load();
+
+      return pid == 0 || kill(pid, 0) == 0 || errno != ESRCH;
+    }
+
+    void CopyIn(uint64_t pos, const uint8_t* src, size_t size) {
+      const size_t offset = pos & (capacity_ - 1);
+      const size_t first = std::min(size, capacity_ - offset);
+
+      memcpy(data_ + offset, src, first);
+      memcpy(data_, src + first, size - first);
+    }
+
+    void CopyOut(uint8_t* dst, uint64_t pos, size_t size) {
+      const size_t offset = pos & (capacity_ - 1);
+      const size_t first = std::min(size, capacity_ - offset);
+
+      memcpy(dst, data_ + offset, first);
+      memcpy(dst + first, data_, size - first);
+    }
+
+    Control* control_;
+    uint8_t* data_;
+    size_t capacity_;
+    std::atomic<uint32_t>* closed_;
+    std::atomic<int32_t>* peerPid_;
+    unsigned spinCount_;
+
+    // Producer's head, it is published to 'control_->head' in 'Publish'.
+    uint64_t head_;
+  };
+
+  // Shared memory object with the request and the reply rings.
+  // A frame can be larger than a ring, it is passed through it, a frame larger than 'maxFrameSize' closes the channel.
+  struct ShmChannel {
+    static constexpr size_t DefaultCapacity = 1 << 20;
+    static constexpr size_t DefaultMaxFrameSize = size_t(64) << 20;
+
+    // Creates the channel 'name' (e.g. "/my-service"), 'capacity' of each ring is rounded up to a power of 2.
+    ShmChannel(const std::string& name, size_t capacity, unsigned spinCount, size_t maxFrameSize = DefaultMaxFrameSize) :
+      name_(name), owner_(true), maxFrameSize_(maxFrameSize) {
+      capacity_ = 4096;
+      while (capacity_ < capacity) {
+        capacity_ *= 2;
+      }
+
+      const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+      if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open '" + name + "'");
+      }
+
+      size_ = sizeof(Control) + 2 * capacity_;
+      if (ftruncate(fd, size_) != 0) {
+        const int error = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "ftruncate '" + name + "'");
+      }
+
+      Map(fd);
+
+      new (control_) Control{};
+      control_->capacity = capacity_;
+      control_->serverPid.store(getpid());
+      control_->magic.store(Control::Magic);
+
+      InitRings(&control_->clientPid, spinCount);
+    }
+
+    // Opens the channel 'name' that is created by the other side.
+    ShmChannel(const std::string& name, unsigned spinCount, size_t maxFrameSize = DefaultMaxFrameSize) :
+      name_(name), owner_(false), maxFrameSize_(maxFrameSize) {
+      const int fd = shm_open(name.c_str(), O_RDWR, 0);
+      if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open '" + name + "'");
+      }
+
+      struct stat st;
+      if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Control)) {
+        close(fd);
+        throw std::runtime_error("IPC shared memory '" + name + "' is not a channel");
+      }
+
+      size_ = st.st_size;
+      Map(fd);
+
+      if (control_->magic.load() != Control::Magic || size_ != sizeof(Control) + 2 * control_->capacity) {
+        munmap(control_, size_);
+        throw std::runtime_error("IPC shared memory '" + name + "' is not a channel");
+      }
+
+      capacity_ = control_->capacity;
+      control_->clientPid.store(getpid());
+
+      InitRings(&control_->serverPid, spinCount);
+    }
+
+    ShmChannel(const ShmChannel&) = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+    ~ShmChannel() {
+      Close();
+
+      munmap(control_, size_);
+
+      if (owner_) {
+        shm_unlink(name_.c_str());
+      }
+    }
+
+    // Wakes up and fails all waits on both sides.
+    void Close() {
+      control_->closed.store(1);
+
+      requests_->WakeAll();
+      replies_->WakeAll();
+    }
+
+    void WriteFrame(ShmRing& ring, FrameKind kind, const void* data, size_t size) {
+      const FrameHeader header = { kind, 0, size };
+
+      ring.Write(&header, sizeof(header), false);
+      ring.Write(data, size, true);
+    }
+
+    // Reads a frame into a buffer from 'BufferPool'.
+    FrameKind ReadFrame(ShmRing& ring, bytes_t& bytes) {
+      FrameHeader header;
+      ring.Read(&header, sizeof(header));
+
+      // The peer is corrupt or hostile, the rest of the ring can't be trusted.
+      if (header.size > maxFrameSize_) {
+        Close();
+        throw ShmClosed();
+      }
+
+      bytes = BufferPool::Acquire();
+      bytes.resize(header.size);
+      ring.Read(bytes.data(), header.size);
+
+      return header.kind;
+    }
+
+    ShmRing& Requests() {
+      return *requests_;
+    }
+
+    ShmRing& Replies() {
+      return *replies_;
+    }
+
+  private:
+    struct Control {
+      static constexpr uint64_t Magic = 0x6c6c614363704900; // "IpcCall"
+
+      std::atomic<uint64_t> magic;
+      uint64_t capacity;
+      std::atomic<uint32_t> closed;
+      std::atomic<int32_t> serverPid;
+      std::atomic<int32_t> clientPid;
+
+      ShmRing::Control requests;
+      ShmRing::Control replies;
+    };
+
+    void Map(int fd) {
+      void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      const int error = errno;
+
+      close(fd);
+
+      if (p == MAP_FAILED) {
+        if (owner_) {
+          shm_unlink(name_.c_str());
+        }
+
+        throw std::system_error(error, std::generic_category(), "mmap '" + name_ + "'");
+      }
+
+      control_ = static_cast<Control*>(p);
+    }
+
+    void InitRings(std::atomic<int32_t>* peerPid, unsigned spinCount) {
+      const auto data = reinterpret_cast<uint8_t*>(control_ + 1);
+
+      requests_.emplace(&control_->requests, data, capacity_, &control_->closed, peerPid, spinCount);
+      replies_.emplace(&control_->replies, data + capacity_, capacity_, &control_->closed, peerPid, spinCount);
+    }
+
+    std::string name_;
+    bool owner_;
+    const size_t maxFrameSize_;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    Control* control_ = nullptr;
+
+    std::optional<ShmRing> requests_;
+    std::optional<ShmRing> replies_;
+  };
+
+  // Client side of a channel that is created by 'ShmServer'.
+  //   IpcCall::ShmClient client("/my-service");
+  //   auto res = IPC_SEND_RECEIVE(f)(args...)(client.Sync());
+  //   IPC_SEND(g)(args...)(client.Async());
+  struct ShmClient {
+    ShmClient(const std::string& name, unsigned spinCount = 0, size_t maxFrameSize = ShmChannel::DefaultMaxFrameSize) :
+      channel_(name, spinCount, maxFrameSize) {}
+
+    bytes_t SyncCall(const bytes_t& bytes) {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      channel_.WriteFrame(channel_.Requests(), FrameKind::SyncRequest, bytes.data(), bytes.size());
+
+      bytes_t reply;
+      if (channel_.ReadFrame(channel_.Replies(), reply) == FrameKind::Error) {
+        throw std::runtime_error(std::string(reply.begin(), reply.end()));
+      }
+
+      return reply;
+    }
+
+    void AsyncCall(const bytes_t& bytes) {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      channel_.WriteFrame(channel_.Requests(), FrameKind::AsyncRequest, bytes.data(), bytes.size());
+    }
+
+    // Transport for 'IPC_SEND_RECEIVE'.
+    auto Sync() {
+      return [this](const bytes_t& bytes) { return SyncCall(bytes); };
+    }
+
+    // Transport for 'IPC_SEND'.
+    auto Async() {
+      return [this](const bytes_t& bytes) { AsyncCall(bytes); };
+    }
+
+  private:
+    ShmChannel channel_;
+    std::mutex mutex_;
+  };
+
+  // Server side of a channel, it creates the channel and calls 'Server::SyncCall' and 'Server::AsyncCall'.
+  struct ShmServer {
+    ShmServer(const std::string& name, size_t capacity = ShmChannel::DefaultCapacity, unsigned spinCount = 0,
+              size_t maxFrameSize = ShmChannel::DefaultMaxFrameSize) :
+      channel_(name, capacity, spinCount, maxFrameSize) {}
+
+    // Serves requests until the client closes the channel.
+    void Run() {
+      try {
+        while (true) {
+          bytes_t request;
+          const auto kind = channel_.ReadFrame(channel_.Requests(), request);
+
+          if (kind == FrameKind::SyncRequest) {
+            bytes_t reply;
+            auto replyKind = FrameKind::Reply;
+
+            try {
+              reply = Server::SyncCall(request);
+            } catch (const std::exception& e) {
+              const std::string what = e.what();
+
+              reply.assign(what.begin(), what.end());
+              replyKind = FrameKind::Error;
+            } catch (...) {
+              const std::string what = "IPC server error";
+
+              reply.assign(what.begin(), what.end());
+              replyKind = FrameKind::Error;
+            }
+
+            channel_.WriteFrame(channel_.Replies(), replyKind, reply.data(), reply.size());
+
+            BufferPool::Release(std::move(reply));
+          } else if (kind == FrameKind::AsyncRequest) {
+            // There is no one to report an error of an asynchronous call to.
+            try {
+              Server::AsyncCall(request);
+            } catch (...) {
+            }
+          }
+
+          BufferPool::Release(std::move(request));
+        }
+      } catch (const ShmClosed&) {
+      }
+    }
+
+    // Makes 'Run' return.
+    void Stop() {
+      channel_.Close();
+    }
+
+  private:
+    ShmChannel channel_;
+  };
+}
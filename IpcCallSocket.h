@@ -0,0 +1,967 @@
+// Unix domain socket IPC transport (Linux).
+//
+// Messages are sent as frames (see 'IpcCallFrame.h'). The client uses blocking I/O,
+// the server is a non-blocking epoll event loop that serves many connections,
+// it calls functions on its thread or on the worker threads of a 'Dispatcher'.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "IpcCallServer.h"
+#include "IpcCallDispatcher.h"
+#include "IpcCallFrame.h"
+#include "IpcCallStream.h"
+
+namespace IpcCall {
+  // Default maximum size of a received frame, a peer can't make the receiver allocate more.
+  inline constexpr size_t SocketMaxFrameSize = size_t(64) << 20;
+
+  inline sockaddr_un SocketAddress(const std::string& path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+      throw std::runtime_error("IPC socket path '" + path + "' is too long");
+    }
+
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    return addr;
+  }
+
+  // Connected blocking socket.
+  inline int SocketConnect(const std::string& path) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "socket");
+    }
+
+    const auto addr = SocketAddress(path);
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+      const int error = errno;
+      close(fd);
+      throw std::system_error(error, std::generic_category(), "connect '" + path + "'");
+    }
+
+    return fd;
+  }
+
+  // Writes a frame to a blocking socket, a closed peer is an exception instead of 'SIGPIPE'.
+  inline void SocketWriteFrame(int fd, FrameKind kind, const bytes_t& bytes) {
+    FrameHeader header = { kind, 0, bytes.size() };
+
+    iovec iov[2] = { { &header, sizeof(header) }, { const_cast<uint8_t*>(bytes.data()), bytes.size() } };
+
+    for (size_t index = 0, left = sizeof(header) + bytes.size(); left; ) {
+      msghdr msg = {};
+      msg.msg_iov = iov + index;
+      msg.msg_iovlen = 2 - index;
+
+      const auto n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        throw std::system_error(errno, std::generic_category(), "IPC socket write");
+      }
+
+      left -= n;
+
+      for (size_t written = n; written; ) {
+        const size_t m = std::min(written, iov[index].iov_len);
+
+        iov[index].iov_base = static_cast<uint8_t*>(iov[index].iov_base) + m;
+        iov[index].iov_len -= m;
+        written -= m;
+
+        if (iov[index].iov_len == 0 && index < 1) {
+          index++;
+        }
+      }
+    }
+  }
+
+  inline void SocketReadAll(int fd, void* data, size_t size) {
+    for (auto p = static_cast<uint8_t*>(data); size; ) {
+      const auto n = read(fd, p, size);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (n <= 0) {
+        throw std::runtime_error("IPC socket is closed");
+      }
+
+      p += n;
+      size -= n;
+    }
+  }
+
+  // Connection of a streaming call, it uses blocking I/O, so a writer waits while the peer doesn't read.
+  // A frame larger than 'maxFrameSize' fails the stream, nothing more is read from the connection.
+  struct SocketStreamChannel: StreamChannel {
+    // On the client, connects to 'path'.
+    explicit SocketStreamChannel(const std::string& path, size_t maxFrameSize = SocketMaxFrameSize) :
+      fd_(SocketConnect(path)), maxFrameSize_(maxFrameSize) {}
+
+    // On the server, takes 'fd' and the bytes that are already 'received' from it.
+    SocketStreamChannel(int fd, bytes_t&& received, size_t maxFrameSize) :
+      fd_(fd), maxFrameSize_(maxFrameSize), received_(std::move(received)) {}
+
+    SocketStreamChannel(const SocketStreamChannel&) = delete;
+    SocketStreamChannel& operator=(const SocketStreamChannel&) = delete;
+
+    ~SocketStreamChannel() override {
+      close(fd_);
+    }
+
+    void Write(FrameKind kind, const bytes_t& bytes) override {
+      SocketWriteFrame(fd_, kind, bytes);
+    }
+
+    FrameKind Read(bytes_t& bytes) override {
+      FrameHeader header;
+      ReadAll(&header, sizeof(header));
+
+      if (header.size > maxFrameSize_) {
+        inputOpen = false;
+        shutdown(fd_, SHUT_RD);
+
+        throw std::runtime_error("IPC socket frame is too large");
+      }
+
+      bytes.resize(header.size);
+      ReadAll(bytes.data(), bytes.size());
+
+      return header.kind;
+    }
+
+  private:
+    void ReadAll(void* data, size_t size) {
+      const size_t m = std::min(size, received_.size() - offset_);
+      if (m) {
+        memcpy(data, received_.data() + offset_, m);
+        offset_ += m;
+      }
+
+      SocketReadAll(fd_, static_cast<uint8_t*>(data) + m, size - m);
+    }
+
+    int fd_;
+    const size_t maxFrameSize_;
+
+    bytes_t received_;
+    size_t offset_ = 0;
+  };
+
+  // Client side of a connection to 'SocketServer'.
+  //   IpcCall::SocketClient client("/tmp/my-service.sock");
+  //   auto res = IPC_SEND_RECEIVE(f)(args...)(client.Sync());
+  //   auto future = IPC_CALL_FUTURE(f)(args...)(client.Future());
+  //   IPC_SEND(g)(args...)(client.Async());
+  //
+  // The first pipelined call starts a thread that receives all replies, before it a synchronous call receives its own reply.
+  // A reply larger than 'maxFrameSize' closes the connection.
+  struct SocketClient {
+    SocketClient(const std::string& path, size_t maxFrameSize = SocketMaxFrameSize) :
+      path_(path), fd_(SocketConnect(path)), maxFrameSize_(maxFrameSize) {}
+
+    SocketClient(const SocketClient&) = delete;
+    SocketClient& operator=(const SocketClient&) = delete;
+
+    // Calls that are still in flight fail.
+    ~SocketClient() {
+      if (reader_.joinable()) {
+        shutdown(fd_, SHUT_RDWR);
+        reader_.join();
+      }
+
+      close(fd_);
+    }
+
+    bytes_t SyncCall(const bytes_t& bytes) {
+      // One synchronous call at a time, its reply has no call ID.
+      std::lock_guard<std::mutex> syncLock(syncMutex_);
+
+      if (!reading_) {
+        {
+          std::lock_guard<std::mutex> lock(writeMutex_);
+          WriteFrame(FrameKind::SyncRequest, bytes);
+        }
+
+        FrameHeader header;
+        auto reply = ReadFrame(header);
+
+        if (header.kind == FrameKind::Error) {
+          throw std::runtime_error(std::string(reply.begin(), reply.end()));
+        }
+
+        return reply;
+      }
+
+      // The reader thread receives the reply.
+      std::promise<bytes_t> promise;
+      auto future = promise.get_future();
+      {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        if (closed_) {
+          throw std::runtime_error("IPC socket is closed");
+        }
+
+        syncReply_ = &promise;
+      }
+
+      try {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        WriteFrame(FrameKind::SyncRequest, bytes);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        syncReply_ = nullptr;
+        throw;
+      }
+
+      return future.get();
+    }
+
+    // 'completion' is called on the reader thread.
+    void PipelinedCall(const bytes_t& bytes, call_id_t callId, Completion completion) {
+      if (!reading_) {
+        StartReader();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        if (closed_) {
+          throw std::runtime_error("IPC socket is closed");
+        }
+
+        pending_.emplace(callId, std::move(completion));
+      }
+
+      try {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        WriteFrame(FrameKind::PipelinedRequest, bytes);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        pending_.erase(callId);
+        throw;
+      }
+    }
+
+    void AsyncCall(const bytes_t& bytes) {
+      std::lock_guard<std::mutex> lock(writeMutex_);
+
+      WriteFrame(FrameKind::AsyncRequest, bytes);
+    }
+
+    // Transport for 'IPC_SEND_RECEIVE'.
+    auto Sync() {
+      return [this](const bytes_t& bytes) { return SyncCall(bytes); };
+    }
+
+    // Transport for 'IPC_CALL_FUTURE'.
+    auto Future() {
+      return [this](const bytes_t& bytes, call_id_t callId, Completion completion) { PipelinedCall(bytes, callId, std::move(completion)); };
+    }
+
+    // Transport for 'IPC_SEND'.
+    auto Async() {
+      return [this](const bytes_t& bytes) { AsyncCall(bytes); };
+    }
+
+    // Transport for 'IPC_SEND_RECEIVE' of a call with streams, it opens a connection for every call.
+    auto Stream() {
+      return [path = path_, maxFrameSize = maxFrameSize_]() -> std::shared_ptr<StreamChannel> {
+        return std::make_shared<SocketStreamChannel>(path, maxFrameSize);
+      };
+    }
+
+  private:
+    // It waits for a synchronous call that receives its own reply.
+    void StartReader() {
+      std::lock_guard<std::mutex> syncLock(syncMutex_);
+
+      if (!reading_) {
+        reader_ = std::thread([this] { Read(); });
+        reading_ = true;
+      }
+    }
+
+    // Reader thread, passes replies to their calls until the connection is closed.
+    void Read() {
+      try {
+        while (true) {
+          FrameHeader header;
+          auto reply = ReadFrame(header);
+
+          if (header.kind == FrameKind::Reply || header.kind == FrameKind::Error) {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+
+            if (syncReply_ != nullptr) {
+              if (header.kind == FrameKind::Error) {
+                syncReply_->set_exception(std::make_exception_ptr(std::runtime_error(std::string(reply.begin(), reply.end()))));
+              } else {
+                syncReply_->set_value(std::move(reply));
+              }
+
+              syncReply_ = nullptr;
+            }
+
+            continue;
+          }
+
+          const call_id_t callId = ReplyCallId(reply);
+
+          Completion completion;
+          {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+
+            auto it = pending_.find(callId);
+            if (it == pending_.end()) {
+              continue;
+            }
+
+            completion = std::move(it->second);
+            pending_.erase(it);
+          }
+
+          if (header.kind == FrameKind::PipelinedError) {
+            const std::string what(reply.begin() + sizeof(callId), reply.end());
+            BufferPool::Release(std::move(reply));
+
+            completion({}, std::make_exception_ptr(std::runtime_error(what)));
+          } else {
+            completion(std::move(reply), nullptr);
+          }
+        }
+      } catch (const std::exception&) {
+      }
+
+      // The connection is closed, calls in flight fail.
+      std::unordered_map<call_id_t, Completion> pending;
+      {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+
+        closed_ = true;
+        pending.swap(pending_);
+
+        if (syncReply_ != nullptr) {
+          syncReply_->set_exception(std::make_exception_ptr(std::runtime_error("IPC socket is closed")));
+          syncReply_ = nullptr;
+        }
+      }
+
+      for (auto& [callId, completion] : pending) {
+        completion({}, std::make_exception_ptr(std::runtime_error("IPC socket is closed")));
+      }
+    }
+
+    void WriteFrame(FrameKind kind, const bytes_t& bytes) {
+      SocketWriteFrame(fd_, kind, bytes);
+    }
+
+    bytes_t ReadFrame(FrameHeader& header) {
+      SocketReadAll(fd_, &header, sizeof(header));
+
+      // The rest of the frame is not read, so the connection can't be used anymore.
+      if (header.size > maxFrameSize_) {
+        shutdown(fd_, SHUT_RDWR);
+        throw std::runtime_error("IPC socket frame is too large");
+      }
+
+      auto bytes = BufferPool::Acquire();
+      bytes.resize(header.size);
+      SocketReadAll(fd_, bytes.data(), bytes.size());
+
+      return bytes;
+    }
+
+    std::string path_;
+    int fd_;
+    const size_t maxFrameSize_;
+
+    std::mutex writeMutex_;
+    std::mutex syncMutex_;
+
+    // Reader thread and the calls that wait for its replies.
+    std::thread reader_;
+    std::atomic<bool> reading_ = false;
+
+    std::mutex pendingMutex_;
+    std::unordered_map<call_id_t, Completion> pending_;
+    std::promise<bytes_t>* syncReply_ = nullptr;
+    bool closed_ = false;
+  };
+
+  // Server side, it accepts connections on 'path' and calls 'Server::SyncCall' and 'Server::AsyncCall',
+  // or passes the calls to 'dispatcher' if it is not null.
+  // A connection that sends a frame larger than 'maxFrameSize' is closed before the frame is allocated,
+  // a stream that receives such a frame fails.
+  struct SocketServer {
+    static constexpr size_t ReadBufferSize = 64 * 1024;
+    static constexpr size_t DefaultMaxFrameSize = SocketMaxFrameSize;
+    static constexpr int MaxEvents = 64;
+
+    SocketServer(const std::string& path, Dispatcher* dispatcher = nullptr, size_t maxFrameSize = DefaultMaxFrameSize) :
+      path_(path), dispatcher_(dispatcher), maxFrameSize_(maxFrameSize) {
+      listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listenFd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "socket");
+      }
+
+      unlink(path.c_str());
+
+      const auto addr = SocketAddress(path);
+      if (bind(listenFd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd_, SOMAXCONN) != 0) {
+        const int error = errno;
+        close(listenFd_);
+        throw std::system_error(error, std::generic_category(), "bind '" + path + "'");
+      }
+
+      epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+      stopFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      completionFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+      Control(EPOLL_CTL_ADD, listenFd_, EPOLLIN, ListenId);
+      Control(EPOLL_CTL_ADD, stopFd_, EPOLLIN, StopId);
+      Control(EPOLL_CTL_ADD, completionFd_, EPOLLIN, CompletionId);
+    }
+
+    SocketServer(const SocketServer&) = delete;
+    SocketServer& operator=(const SocketServer&) = delete;
+
+    // Waits for the calls that are passed to 'dispatcher', streaming calls are interrupted.
+    ~SocketServer() {
+      {
+        std::unique_lock<std::mutex> lock(completionMutex_);
+        completionCondition_.wait(lock, [this] { return inFlight_ == 0; });
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(streamMutex_);
+
+        for (auto& stream : streams_) {
+          if (stream.fd >= 0) {
+            shutdown(stream.fd, SHUT_RDWR);
+          }
+        }
+      }
+
+      for (auto& stream : streams_) {
+        stream.thread.join();
+      }
+
+      for (auto& [id, connection] : connections_) {
+        close(connection.fd);
+      }
+
+      close(completionFd_);
+      close(stopFd_);
+      close(epollFd_);
+      close(listenFd_);
+
+      unlink(path_.c_str());
+    }
+
+    // Serves connections until 'Stop' is called.
+    void Run() {
+      epoll_event events[MaxEvents];
+
+      while (true) {
+        const int count = epoll_wait(epollFd_, events, MaxEvents, -1);
+        if (count < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          throw std::system_error(errno, std::generic_category(), "epoll_wait");
+        }
+
+        for (int i = 0; i < count; i++) {
+          const uint64_t id = events[i].data.u64;
+
+          if (id == StopId) {
+            uint64_t value;
+            (void)!read(stopFd_, &value, sizeof(value));
+
+            return;
+          }
+
+          if (id == ListenId) {
+            Accept();
+            continue;
+          }
+
+          if (id == CompletionId) {
+            Complete();
+            continue;
+          }
+
+          auto it = connections_.find(id);
+          if (it == connections_.end()) {
+            continue;
+          }
+
+          auto& connection = it->second;
+
+          bool open = !(events[i].events & (EPOLLERR | EPOLLHUP)) || (events[i].events & EPOLLIN);
+
+          if (open && (events[i].events & EPOLLIN)) {
+            open = Receive(connection);
+          }
+
+          if (open) {
+            open = Flush(connection);
+          }
+
+          if (!open) {
+            Close(it);
+          }
+        }
+      }
+    }
+
+    // Makes 'Run' return, it can be called from any thread.
+    void Stop() {
+      const uint64_t value = 1;
+      (void)!write(stopFd_, &value, sizeof(value));
+    }
+
+  private:
+    // Epoll IDs, connections have the following IDs.
+    static constexpr uint64_t ListenId = 0;
+    static constexpr uint64_t StopId = 1;
+    static constexpr uint64_t CompletionId = 2;
+
+    struct Reply {
+      FrameHeader header;
+      bytes_t bytes;
+    };
+
+    struct Connection {
+      uint64_t id;
+      int fd;
+
+      // Received bytes that are not consumed yet, [begin, end) of 'buffer'.
+      bytes_t buffer = bytes_t(ReadBufferSize);
+      size_t begin = 0;
+      size_t end = 0;
+
+      // The frame that is being received.
+      bool hasHeader = false;
+      FrameHeader header = {};
+      bytes_t frame;
+      size_t frameSize = 0;
+
+      // Replies that are not sent yet, 'offset' bytes of the first one are sent.
+      std::deque<Reply> replies;
+      size_t offset = 0;
+
+      bool writing = false;
+
+      // 'frame' is 'FrameKind::StreamRequest', the connection is passed to a stream thread.
+      bool stream = false;
+    };
+
+    // Thread of a streaming call, 'fd' is -1 when it is done.
+    struct Stream {
+      std::thread thread;
+      int fd;
+    };
+
+    void Control(int op, int fd, uint32_t events, uint64_t id) {
+      epoll_event event = {};
+      event.events = events;
+      event.data.u64 = id;
+
+      if (epoll_ctl(epollFd_, op, fd, &event) != 0) {
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+      }
+    }
+
+    void Accept() {
+      while (true) {
+        const int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+          return;
+        }
+
+        const uint64_t id = nextId_++;
+
+        auto& connection = connections_[id];
+        connection.id = id;
+        connection.fd = fd;
+        Control(EPOLL_CTL_ADD, fd, EPOLLIN, id);
+      }
+    }
+
+    void Close(std::unordered_map<uint64_t, Connection>::iterator it) {
+      if (it->second.stream) {
+        StartStream(it->second);
+      } else {
+        close(it->second.fd);
+      }
+
+      connections_.erase(it);
+    }
+
+    // A streaming call blocks on its connection in its own thread, the bytes that are received after its request are passed to it.
+    void StartStream(Connection& connection) {
+      epoll_ctl(epollFd_, EPOLL_CTL_DEL, connection.fd, nullptr);
+      fcntl(connection.fd, F_SETFL, fcntl(connection.fd, F_GETFL) & ~O_NONBLOCK);
+
+      auto channel = std::make_shared<SocketStreamChannel>(connection.fd,
+        bytes_t(connection.buffer.begin() + connection.begin, connection.buffer.begin() + connection.end), maxFrameSize_);
+
+      std::lock_guard<std::mutex> lock(streamMutex_);
+
+      // Threads of finished streams.
+      for (auto it = streams_.begin(); it != streams_.end(); ) {
+        if (it->fd < 0) {
+          it->thread.join();
+          it = streams_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+
+      auto& stream = streams_.emplace_back();
+      stream.fd = connection.fd;
+      stream.thread = std::thread([this, &stream, channel = std::move(channel), request = std::move(connection.frame)]() mutable {
+        // The client closed the connection.
+        try {
+          Server::StreamCall(request, *channel);
+        } catch (const std::exception&) {
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(streamMutex_);
+          stream.fd = -1;
+        }
+
+        channel.reset();
+      });
+    }
+
+    // Reads with 'readv' the rest of the current frame directly into it and the following frames into 'buffer',
+    // then dispatches all complete frames. Returns false if the connection is closed.
+    bool Receive(Connection& connection) {
+      if (connection.begin == connection.end) {
+        connection.begin = connection.end = 0;
+      } else if (connection.end == connection.buffer.size()) {
+        std::copy(connection.buffer.begin() + connection.begin, connection.buffer.begin() + connection.end, connection.buffer.begin());
+        connection.end -= connection.begin;
+        connection.begin = 0;
+      }
+
+      iovec iov[2];
+      int iovCount = 0;
+
+      if (connection.hasHeader && connection.begin == connection.end) {
+        iov[iovCount++] = { connection.frame.data() + connection.frameSize, connection.frame.size() - connection.frameSize };
+      }
+
+      iov[iovCount++] = { connection.buffer.data() + connection.end, connection.buffer.size() - connection.end };
+
+      const auto n = readv(connection.fd, iov, iovCount);
+      if (n == 0) {
+        return false;
+      }
+
+      if (n < 0) {
+        return errno == EAGAIN || errno == EINTR;
+      }
+
+      size_t received = n;
+      if (iovCount == 2) {
+        const size_t m = std::min(received, iov[0].iov_len);
+
+        connection.frameSize += m;
+        received -= m;
+      }
+
+      connection.end += received;
+
+      return Dispatch(connection);
+    }
+
+    bool Dispatch(Connection& connection) {
+      while (true) {
+        if (!connection.hasHeader) {
+          if (connection.end - connection.begin < sizeof(FrameHeader)) {
+            return true;
+          }
+
+          memcpy(&connection.header, connection.buffer.data() + connection.begin, sizeof(FrameHeader));
+          connection.begin += sizeof(FrameHeader);
+
+          if (connection.header.size > maxFrameSize_) {
+            return false;
+          }
+
+          connection.hasHeader = true;
+          connection.frame = BufferPool::Acquire();
+          connection.frame.resize(connection.header.size);
+          connection.frameSize = 0;
+        }
+
+        const size_t m = std::min(connection.end - connection.begin, connection.frame.size() - connection.frameSize);
+        memcpy(connection.frame.data() + connection.frameSize, connection.buffer.data() + connection.begin, m);
+
+        connection.begin += m;
+        connection.frameSize += m;
+
+        if (connection.frameSize < connection.frame.size()) {
+          return true;
+        }
+
+        connection.hasHeader = false;
+
+        // The connection is passed to a stream thread when it is closed.
+        if (connection.header.kind == FrameKind::StreamRequest) {
+          connection.stream = true;
+          return false;
+        }
+
+        Call(connection, connection.header.kind, std::move(connection.frame));
+      }
+    }
+
+    void Call(Connection& connection, FrameKind kind, bytes_t&& request) {
+      const bool sync = kind == FrameKind::SyncRequest || kind == FrameKind::PipelinedRequest;
+      const call_id_t callId = kind == FrameKind::PipelinedRequest ? RequestCallId(request) : 0;
+
+      if (dispatcher_ != nullptr) {
+        if (sync) {
+          {
+            std::lock_guard<std::mutex> lock(completionMutex_);
+            inFlight_++;
+          }
+
+          dispatcher_->SyncCall(std::move(request), [this, id = connection.id, kind, callId](bytes_t&& reply, std::exception_ptr error) {
+            PostReply(id, MakeReply(kind, callId, std::move(reply), error));
+          });
+        } else if (kind == FrameKind::AsyncRequest) {
+          dispatcher_->AsyncCall(std::move(request));
+        }
+
+        return;
+      }
+
+      if (sync) {
+        bytes_t reply;
+        std::exception_ptr error;
+
+        try {
+          reply = Server::SyncCall(request);
+        } catch (...) {
+          error = std::current_exception();
+        }
+
+        connection.replies.push_back(MakeReply(kind, callId, std::move(reply), error));
+      } else if (kind == FrameKind::AsyncRequest) {
+        // There is no one to report an error of an asynchronous call to.
+        try {
+          Server::AsyncCall(request);
+        } catch (const std::exception&) {
+        }
+      }
+
+      BufferPool::Release(std::move(request));
+    }
+
+    // 'callId' of a pipelined request, 0 if its header is invalid, then the call fails.
+    static call_id_t RequestCallId(const bytes_t& request) {
+      try {
+        Unserializer unserializer(request);
+
+        Header header;
+        unserializer >> header;
+
+        return header.callId;
+      } catch (const std::exception&) {
+        return 0;
+      }
+    }
+
+    // Reply to a request of 'kind', an error of a pipelined call starts with 'callId'.
+    static Reply MakeReply(FrameKind kind, call_id_t callId, bytes_t&& bytes, std::exception_ptr error) {
+      const bool pipelined = kind == FrameKind::PipelinedRequest;
+
+      Reply reply = { { pipelined ? FrameKind::PipelinedReply : FrameKind::Reply, 0, 0 }, std::move(bytes) };
+
+      if (error) {
+        std::string what = "IPC server error";
+        try {
+          std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+          what = e.what();
+        } catch (...) {
+        }
+
+        reply.header.kind = pipelined ? FrameKind::PipelinedError : FrameKind::Error;
+        reply.bytes.clear();
+
+        if (pipelined) {
+          const auto p = reinterpret_cast<const uint8_t*>(&callId);
+          reply.bytes.insert(reply.bytes.end(), p, p + sizeof(callId));
+        }
+
+        reply.bytes.insert(reply.bytes.end(), what.begin(), what.end());
+      }
+
+      reply.header.size = reply.bytes.size();
+
+      return reply;
+    }
+
+    // Called by a 'dispatcher' worker, the reply is sent by the event loop.
+    void PostReply(uint64_t id, Reply&& reply) {
+      {
+        std::lock_guard<std::mutex> lock(completionMutex_);
+        completions_.emplace_back(id, std::move(reply));
+      }
+
+      const uint64_t value = 1;
+      (void)!write(completionFd_, &value, sizeof(value));
+
+      // Notify under the lock, the destructor can run as soon as 'inFlight_' is 0.
+      std::lock_guard<std::mutex> lock(completionMutex_);
+      inFlight_--;
+      completionCondition_.notify_all();
+    }
+
+    // Sends replies that are posted by 'PostReply', replies to closed connections are dropped.
+    void Complete() {
+      uint64_t value;
+      (void)!read(completionFd_, &value, sizeof(value));
+
+      std::vector<std::pair<uint64_t, Reply>> completions;
+      {
+        std::lock_guard<std::mutex> lock(completionMutex_);
+        completions.swap(completions_);
+      }
+
+      for (auto& [id, reply] : completions) {
+        auto it = connections_.find(id);
+        if (it == connections_.end()) {
+          BufferPool::Release(std::move(reply.bytes));
+          continue;
+        }
+
+        it->second.replies.push_back(std::move(reply));
+      }
+
+      for (auto& [id, reply] : completions) {
+        auto it = connections_.find(id);
+        if (it != connections_.end() && !it->second.replies.empty() && !Flush(it->second)) {
+          Close(it);
+        }
+      }
+    }
+
+    // Sends pending replies with 'writev'. While they can't be sent, the connection waits for 'EPOLLOUT' instead of reading.
+    // Returns false if the connection is closed.
+    bool Flush(Connection& connection) {
+      while (!connection.replies.empty()) {
+        iovec iov[2 * MaxEvents];
+        int iovCount = 0;
+
+        size_t skip = connection.offset;
+        for (auto& reply : connection.replies) {
+          if (iovCount == 2 * MaxEvents) {
+            break;
+          }
+
+          const iovec parts[2] = { { &reply.header, sizeof(reply.header) }, { reply.bytes.data(), reply.bytes.size() } };
+          for (const auto& part : parts) {
+            if (skip >= part.iov_len) {
+              skip -= part.iov_len;
+              continue;
+            }
+
+            iov[iovCount++] = { static_cast<uint8_t*>(part.iov_base) + skip, part.iov_len - skip };
+            skip = 0;
+          }
+        }
+
+        const auto n = writev(connection.fd, iov, iovCount);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          if (errno != EAGAIN) {
+            return false;
+          }
+
+          break;
+        }
+
+        connection.offset += n;
+
+        while (!connection.replies.empty()) {
+          auto& reply = connection.replies.front();
+
+          const size_t size = sizeof(reply.header) + reply.bytes.size();
+          if (connection.offset < size) {
+            break;
+          }
+
+          connection.offset -= size;
+
+          BufferPool::Release(std::move(reply.bytes));
+          connection.replies.pop_front();
+        }
+      }
+
+      const bool writing = !connection.replies.empty();
+      if (writing != connection.writing) {
+        connection.writing = writing;
+        Control(EPOLL_CTL_MOD, connection.fd, writing ? EPOLLOUT : EPOLLIN, connection.id);
+      }
+
+      return true;
+    }
+
+    std::string path_;
+    Dispatcher* dispatcher_;
+    const size_t maxFrameSize_;
+
+    int listenFd_ = -1;
+    int epollFd_ = -1;
+    int stopFd_ = -1;
+    int completionFd_ = -1;
+
+    std::unordered_map<uint64_t, Connection> connections_;
+    uint64_t nextId_ = CompletionId + 1;
+
+    // Replies from 'dispatcher_' workers.
+    std::mutex completionMutex_;
+    std::condition_variable completionCondition_;
+    std::vector<std::pair<uint64_t, Reply>> completions_;
+    size_t inFlight_ = 0;
+
+    std::mutex streamMutex_;
+    std::list<Stream> streams_;
+  };
+}
@@ -0,0 +1,296 @@
+// Streaming parameters and results.
+//
+// An 'InStream<T>' parameter and an 'OutStream<T>' return are sequences of elements that are sent in chunks,
+// so neither side materializes the whole data. A streaming call has its own 'StreamChannel' (a connection),
+// its writer blocks while the reader doesn't consume the chunks, it is the flow control between them.
+//
+//   // Declarations
+//   size_t Import(IpcCall::InStream<Record> records);
+//   IpcCall::OutStream<Record> Export(const std::string& query);
+//
+//   // Client, 'client.Stream()' opens a connection for the call
+//   size_t n = IPC_SEND_RECEIVE(Import)(IpcCall::InStream<Record>(next))(client.Stream());
+//   auto records = IPC_SEND_RECEIVE(Export)("query")(client.Stream());
+//   for (Record record; records.Read(record); ) {...}
+//
+//   // Server, 'next' produces the next element and returns false at the end
+//   size_t Import(IpcCall::InStream<Record> records) { for (Record record; records.Read(record); ) {...} }
+//   IpcCall::OutStream<Record> Export(const std::string& query) { return IpcCall::OutStream<Record>(next); }
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+
+#include "IpcCallData.h"
+#include "IpcCallFrame.h"
+
+namespace IpcCall {
+  // Connection of a streaming call, it is implemented by the transport.
+  struct StreamChannel: std::enable_shared_from_this<StreamChannel> {
+    virtual ~StreamChannel() = default;
+
+    // Sends a frame, it blocks while the peer doesn't consume the previous frames.
+    virtual void Write(FrameKind kind, const bytes_t& bytes) = 0;
+
+    // Receives a frame into 'bytes'.
+    virtual FrameKind Read(bytes_t& bytes) = 0;
+
+    // Reads the rest of the 'InStream' that the server function didn't read.
+    void DrainInput() {
+      auto bytes = BufferPool::Acquire();
+
+      while (inputOpen) {
+        if (Read(bytes) == FrameKind::StreamEnd) {
+          inputOpen = false;
+        }
+      }
+
+      BufferPool::Release(std::move(bytes));
+    }
+
+    // On the server, 'InStream' parameter is not read to the end.
+    bool inputOpen = false;
+
+    // On the server, sends 'OutStream' return after the reply.
+    std::function<void(StreamChannel&)> output;
+  };
+
+  inline constexpr size_t StreamChunkSize = 64 * 1024;
+
+  // Sends elements that are produced by 'next' in chunks of about 'chunkSize' bytes, 'next' returns false at the end.
+  template <typename T>
+  void WriteStream(StreamChannel& channel, Format format, bool compact, const std::function<bool(T&)>& next, size_t chunkSize) {
+    Serializer serializer(BufferPool::Acquire(), format);
+    serializer.SetCompact(compact);
+
+    for (T el; next(el); ) {
+      serializer << el;
+
+      if (serializer.Bytes().size() >= chunkSize) {
+        channel.Write(FrameKind::StreamChunk, serializer.Bytes());
+        serializer = Serializer(serializer.Release(), format);
+        serializer.SetCompact(compact);
+      }
+    }
+
+    if (!serializer.Bytes().empty()) {
+      channel.Write(FrameKind::StreamChunk, serializer.Bytes());
+    }
+
+    BufferPool::Release(serializer.Release());
+
+    channel.Write(FrameKind::StreamEnd, {});
+  }
+
+  // Unserializes elements of a stream from its chunks as they are received.
+  template <typename T>
+  struct StreamReader {
+    StreamReader(std::shared_ptr<StreamChannel> channel, Format format, bool compact, bool input) :
+      channel_(std::move(channel)), format_(format), compact_(compact), input_(input) {}
+
+    ~StreamReader() {
+      BufferPool::Release(std::move(chunk_));
+    }
+
+    bool Read(T& el) {
+      while (!unserializer_ || unserializer_->Available() == 0) {
+        if (end_) {
+          return false;
+        }
+
+        unserializer_.reset();
+
+        switch (channel_->Read(chunk_)) {
+        case FrameKind::StreamChunk:
+          unserializer_.emplace(chunk_, format_);
+          unserializer_->SetCompact(compact_);
+          break;
+
+        case FrameKind::StreamEnd:
+          end_ = true;
+
+          if (input_) {
+            channel_->inputOpen = false;
+          }
+          break;
+
+        case FrameKind::Error:
+          end_ = true;
+          throw std::runtime_error(std::string(chunk_.begin(), chunk_.end()));
+
+        default:
+          end_ = true;
+          throw std::runtime_error("Unexpected IPC frame in a stream");
+        }
+      }
+
+      *unserializer_ >> el;
+
+      return true;
+    }
+
+  private:
+    std::shared_ptr<StreamChannel> channel_;
+    Format format_;
+    bool compact_;
+    bool input_;
+
+    bytes_t chunk_ = BufferPool::Acquire();
+    std::optional<Unserializer> unserializer_;
+    bool end_ = false;
+  };
+
+  // Elements that are sent to the server, it is a parameter of a server function.
+  template <typename T>
+  struct InStream {
+    InStream() = default;
+
+    // On the client, elements are produced by 'next', it returns false at the end.
+    explicit InStream(std::function<bool(T&)> next, size_t chunkSize = StreamChunkSize) : next_(std::move(next)), chunkSize_(chunkSize) {}
+
+    // On the server, reads the next element, returns false at the end.
+    bool Read(T& el) {
+      if (!reader_) {
+        throw std::logic_error("IPC stream is not received");
+      }
+
+      return reader_->Read(el);
+    }
+
+    // On the client, sends the elements after the request.
+    void Write(StreamChannel& channel, Format format, bool compact) const {
+      WriteStream(channel, format, compact, next_, chunkSize_);
+    }
+
+    // On the server, the elements are received from 'channel'.
+    void Receive(StreamChannel& channel, Format format, bool compact) {
+      channel.inputOpen = true;
+      reader_ = std::make_shared<StreamReader<T>>(channel.shared_from_this(), format, compact, true);
+    }
+
+  private:
+    std::function<bool(T&)> next_;
+    size_t chunkSize_ = StreamChunkSize;
+    std::shared_ptr<StreamReader<T>> reader_;
+  };
+
+  // Elements that are sent to the client, it is a return of a server function.
+  template <typename T>
+  struct OutStream {
+    OutStream() = default;
+
+    // On the server, elements are produced by 'next', it returns false at the end.
+    explicit OutStream(std::function<bool(T&)> next, size_t chunkSize = StreamChunkSize) : next_(std::move(next)), chunkSize_(chunkSize) {}
+
+    // On the client, reads the next element, returns false at the end.
+    // The connection of the call is open until the stream is destroyed.
+    bool Read(T& el) {
+      if (!reader_) {
+        throw std::logic_error("IPC stream is not received");
+      }
+
+      return reader_->Read(el);
+    }
+
+    // On the server, the elements are sent after the reply.
+    void Send(StreamChannel& channel, Format format, bool compact) const {
+      channel.output = [next = next_, chunkSize = chunkSize_, format, compact](StreamChannel& channel) {
+        WriteStream(channel, format, compact, next, chunkSize);
+      };
+    }
+
+    // On the client, the elements are received from 'channel'.
+    void Receive(StreamChannel& channel, Format format, bool compact) {
+      reader_ = std::make_shared<StreamReader<T>>(channel.shared_from_this(), format, compact, false);
+    }
+
+  private:
+    std::function<bool(T&)> next_;
+    size_t chunkSize_ = StreamChunkSize;
+    std::shared_ptr<StreamReader<T>> reader_;
+  };
+
+  template <typename T>
+  struct IsInStream: std::false_type {};
+
+  template <typename T>
+  struct IsInStream<InStream<T>>: std::true_type {};
+
+  template <typename T>
+  struct IsOutStream: std::false_type {};
+
+  template <typename T>
+  struct IsOutStream<OutStream<T>>: std::true_type {};
+
+  // A call with 'InStream' parameter or 'OutStream' return needs a streaming transport.
+  template <typename Ret, typename ...Params>
+  constexpr bool IsStreamingCall() {
+    constexpr size_t inStreams = (0 + ... + IsInStream<std::decay_t<Params>>::value);
+
+    static_assert(inStreams <= 1, "Only one 'InStream' parameter is supported");
+
+    return inStreams || IsOutStream<Ret>::value;
+  }
+
+  // The chunks of 'InStream' are sent after the request, it has no data in the request.
+  template <typename T>
+  Serializer& operator << (Serializer& serializer, const InStream<T>&) {
+    return serializer;
+  }
+
+  template <typename T>
+  Unserializer& operator >> (Unserializer& unserializer, InStream<T>& arg) {
+    if (unserializer.GetChannel() == nullptr) {
+      throw std::runtime_error("IPC stream requires a streaming transport");
+    }
+
+    arg.Receive(*unserializer.GetChannel(), unserializer.GetFormat(), unserializer.IsCompact());
+
+    return unserializer;
+  }
+
+  // The chunks of 'OutStream' are sent after the reply, it has no data in the reply.
+  template <typename T>
+  Serializer& operator << (Serializer& serializer, const OutStream<T>& arg) {
+    if (serializer.GetChannel() == nullptr) {
+      throw std::runtime_error("IPC stream requires a streaming transport");
+    }
+
+    arg.Send(*serializer.GetChannel(), serializer.GetFormat(), serializer.IsCompact());
+
+    return serializer;
+  }
+
+  template <typename T>
+  Unserializer& operator >> (Unserializer& unserializer, OutStream<T>& arg) {
+    if (unserializer.GetChannel() == nullptr) {
+      throw std::runtime_error("IPC stream requires a streaming transport");
+    }
+
+    arg.Receive(*unserializer.GetChannel(), unserializer.GetFormat(), unserializer.IsCompact());
+
+    return unserializer;
+  }
+
+  template <typename T>
+  struct SerializedSize<InStream<T>> {
+    static constexpr bool Fixed = true;
+    static constexpr size_t FixedSize = 0;
+
+    static constexpr size_t Size(const InStream<T>&, Format) {
+      return 0;
+    }
+  };
+
+  template <typename T>
+  struct SerializedSize<OutStream<T>> {
+    static constexpr bool Fixed = true;
+    static constexpr size_t FixedSize = 0;
+
+    static constexpr size_t Size(const OutStream<T>&, Format) {
+      return 0;
+    }
+  };
+}
@@ -1,5 +1,8 @@
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <future>
+#include <thread>
 
 #include "IpcCallClient.h"
 #include "IpcCallServer.h"
@@ -23,8 +26,69 @@ namespace IpcCall {
   Unserializer& operator >> (Unserializer& unserializer, Data& data) {
     return unserializer >> data.str_ >> data.n_;
   }
+
+  // Optional, lets the message buffer be reserved once.
+  template <>
+  struct SerializedSize<Data> {
+    static constexpr bool Fixed = false;
+    static constexpr size_t FixedSize = 0;
+
+    static size_t Size(const Data& data, Format format) {
+      return SizeOf(data.str_, format) + SizeOf(data.n_, format);
+    }
+  };
 }
 
+// Example of a trivially copyable custom struct 'Point' that opts in to serialization as raw bytes,
+// 'std::vector<Point>' is serialized with a single 'memcpy'.
+struct Point {
+  bool operator == (const Point& point) const {
+    return x_ == point.x_ && y_ == point.y_;
+  }
+
+  double x_;
+  double y_;
+};
+
+template <> struct IpcCall::TriviallySerializable<Point>: std::true_type {};
+
+// Example of custom structs that declare their serialization by 'IPC_SERIALIZABLE' instead of operators.
+// 'Reading' has no padding, so 'std::vector<Reading>' is serialized with a single 'memcpy'.
+// 'Sample' has padding, its fields are copied at offsets known at compile time.
+// 'Event' has a string, its fields are serialized one by one.
+struct Reading {
+  bool operator == (const Reading& reading) const {
+    return id_ == reading.id_ && value_ == reading.value_;
+  }
+
+  uint32_t id_;
+  float value_;
+};
+
+struct Sample {
+  bool operator == (const Sample& sample) const {
+    return kind_ == sample.kind_ && time_ == sample.time_ && scale_ == sample.scale_;
+  }
+
+  uint8_t kind_;
+  int64_t time_;
+  float scale_;
+};
+
+struct Event {
+  bool operator == (const Event& event) const {
+    return name_ == event.name_ && samples_ == event.samples_ && readings_ == event.readings_;
+  }
+
+  std::string name_;
+  std::vector<Sample> samples_;
+  std::vector<Reading> readings_;
+};
+
+IPC_SERIALIZABLE(Reading, id_, value_);
+IPC_SERIALIZABLE(Sample, kind_, time_, scale_);
+IPC_SERIALIZABLE(Event, name_, samples_, readings_);
+
 
 //
 // Client
@@ -36,6 +100,29 @@ void ABC(const std::string& s);
 // 'XYZ' declaration, used in synchronous call.
 std::list<Data> XYZ(const std::map<std::string, int>& in, std::vector<std::tuple<std::string, int>>& inOut);
 
+// 'Sum' declaration, used in synchronous call.
+Point Sum(const std::vector<Point>& points, std::array<double, 2>& inOut);
+
+// 'Count' declaration, used in synchronous call.
+// On the server 'text' points into the received data without copying it.
+size_t Count(std::wstring_view text, wchar_t c);
+
+// 'Greet' declaration, used in synchronous call, its replies are cached by the server.
+std::string Greet(const std::string& name, uint32_t& inOut);
+
+// 'Overrun' declaration, used in synchronous call with a deadline, if 'overrun' it runs past the deadline of its request.
+int Overrun(bool overrun);
+
+// 'NestedDeadline' declaration, it returns the deadline of its nested IPC call of 'CurrentDeadline'.
+uint64_t NestedDeadline();
+uint64_t CurrentDeadline();
+
+#ifdef __cpp_lib_span
+// 'Average' declaration, used in synchronous call.
+// On the server 'values' points into the received data without copying it.
+double Average(std::span<const double> values);
+#endif
+
 //
 // For asynchronous IPC, transport needs to implement 'IpcAsync' function.
 // 'bytes' is data that is sent to the server. 
@@ -61,14 +148,70 @@ std::vector<uint8_t> IpcSync(const std::vector<uint8_t>& bytes) noexcept(false)
   return IpcCall::Server::SyncCall(bytes);
 }
 
+//
+// For pipelined synchronous IPC, transport needs to implement 'IpcFuture' function.
+// 'bytes' is data that is sent to the server, 'completion' needs to be called with data that is received from the server.
+// Replies can be received in any order, 'IpcCall::ReplyCallId(reply)' is 'callId' of the call.
+//
+// The function needs to be passed as the last argument of `IPC_CALL_FUTURE`.
+static std::vector<std::pair<std::vector<uint8_t>, IpcCall::Completion>> s_replies;
+
+void IpcFuture(const std::vector<uint8_t>& bytes, IpcCall::call_id_t callId, IpcCall::Completion completion) noexcept(false) {
+  // For testing, call the server directly, replies are completed later.
+  auto reply = IpcCall::Server::SyncCall(bytes);
+
+  assert(IpcCall::ReplyCallId(reply) == callId);
+  (void)callId;
+
+  s_replies.emplace_back(std::move(reply), std::move(completion));
+}
+
+#ifdef __cpp_lib_coroutine
+// Coroutine that starts immediately and is not awaited.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Awaits 'Sum', it is resumed when its reply is completed, and 'Count', its transport completes it immediately.
+// The request of 'Count' is serialized when its awaiter is created, so its temporary argument is destroyed before the await.
+Detached SumAndCount(std::array<double, 2>& scale, Point& sum, size_t& count) {
+  auto countCall = IPC_CALL_AWAIT(Count)(std::wstring(L"AAA"), L'A');
+
+  const std::vector<Point> points = { {1, 2} };
+  sum = co_await IPC_CALL_AWAIT(Sum)(points, scale)(IpcFuture);
+
+  count = co_await countCall([](const std::vector<uint8_t>& bytes, IpcCall::call_id_t, IpcCall::Completion completion) {
+    completion(IpcCall::Server::SyncCall(bytes), nullptr);
+  });
+}
+#endif
 
 static std::string s_abcParam;
+static int s_greetCalls;
+static int s_overrunCalls;
+
+// For testing, the server executes the call on another thread.
+static std::vector<uint8_t> IpcThread(const std::vector<uint8_t>& bytes) {
+  return std::async(std::launch::async, [&] { return IpcCall::Server::SyncCall(bytes); }).get();
+}
 
 int main(int, char**) {
   // Test 'ABC'
   IPC_SEND(ABC)("QAZ")(IpcAsync);
   assert(s_abcParam == "QAZ");
 
+  // Strings are length-prefixed, so embedded nulls are preserved.
+  if (IPC_CALL_FORMAT != IpcCall::Format::Legacy) {
+    IPC_SEND(ABC)(std::string("Q\0Z", 3))(IpcAsync);
+    assert(s_abcParam == std::string("Q\0Z", 3));
+  }
+
   // Test 'XYZ'
   std::vector<std::tuple<std::string, int>> inOut = { {"A", 1}, {"B", 2} };
   std::list<Data> res = IPC_SEND_RECEIVE(XYZ)({ {"C", 3}, {"D", 4} }, inOut)(IpcSync);
@@ -76,6 +219,331 @@ int main(int, char**) {
   assert((inOut == decltype(inOut){ {"A", 1}, { "B", 2 }, { "C", 3 }, { "D", 4 } }));
   assert((res == decltype(res){ {"C", 3}, { "D", 4 } }));
 
+  // Test 'Sum'
+  std::array<double, 2> scale = { 2, 3 };
+  Point sum = IPC_SEND_RECEIVE(Sum)({ {1, 2}, {3, 4} }, scale)(IpcSync);
+
+  assert((sum == Point{ 8, 18 }));
+  assert((scale == decltype(scale){ 4, 6 }));
+
+  // Test pipelined 'Sum' and 'Count', their replies are completed in reversed order.
+  if (IPC_CALL_FORMAT >= IpcCall::Format::Flags) {
+    std::array<double, 2> futureScale = { 1, 1 };
+    auto futureSum = IPC_CALL_FUTURE(Sum)({ {1, 2} }, futureScale)(IpcFuture);
+    auto futureCount = IPC_CALL_FUTURE(Count)(L"AA", L'A')(IpcFuture);
+
+    for (auto it = s_replies.rbegin(); it != s_replies.rend(); ++it) {
+      it->second(std::move(it->first), nullptr);
+    }
+    s_replies.clear();
+
+    assert(futureCount.get() == 2);
+    assert((futureSum.get() == Point{ 1, 2 }));
+    assert((futureScale == decltype(futureScale){ 2, 2 }));
+  }
+
+  // Test batch of 'ABC', 'Sum' and 'Count', they are sent in one message.
+  if (IPC_CALL_FORMAT >= IpcCall::Format::Flags) {
+    IpcCall::Batch batch;
+
+    std::array<double, 2> batchScale = { 1, 1 };
+    IPC_SEND(ABC)("WSX")(batch.Async());
+    auto batchSum = IPC_CALL_FUTURE(Sum)({ {1, 2} }, batchScale)(batch.Future());
+    auto batchError = IPC_CALL_FUTURE(Count)(L"", L'A')(batch.Future());
+    auto batchCount = IPC_CALL_FUTURE(Count)(L"AA", L'A')(batch.Future());
+
+    batch.Send(IpcSync);
+    assert(batch.Empty());
+
+    assert(s_abcParam == "WSX");
+    assert((batchSum.get() == Point{ 1, 2 }));
+    assert((batchScale == decltype(batchScale){ 2, 2 }));
+    assert(batchCount.get() == 2);
+
+    // An exception of a call doesn't affect the other calls.
+    try {
+      batchError.get();
+      assert(false);
+    } catch (const std::runtime_error& e) {
+      assert(std::string(e.what()) == "Empty text");
+    }
+  }
+
+#ifdef __cpp_lib_coroutine
+  // Test 'Sum' and 'Count' that are awaited in a coroutine.
+  if (IPC_CALL_FORMAT >= IpcCall::Format::Flags) {
+    std::array<double, 2> awaitScale = { 1, 1 };
+    Point awaitSum = {};
+    size_t awaitCount = 0;
+
+    SumAndCount(awaitScale, awaitSum, awaitCount);
+    assert(awaitCount == 0);
+
+    auto [reply, completion] = std::move(s_replies.front());
+    s_replies.clear();
+
+    completion(std::move(reply), nullptr);
+
+    assert((awaitSum == Point{ 1, 2 }));
+    assert((awaitScale == decltype(awaitScale){ 2, 2 }));
+    assert(awaitCount == 3);
+  }
+#endif
+
+  // Test 'Count'
+  assert(IPC_SEND_RECEIVE(Count)(L"ABACA", L'A')(IpcSync) == 3);
+
+#ifdef __cpp_lib_span
+  // Test 'Average'
+  std::vector<double> values = { 1, 2, 3, 6 };
+  assert(IPC_SEND_RECEIVE(Average)(values)(IpcSync) == 3);
+#endif
+
+  // Test compact encoding, integers and lengths are varints and signed integers are zigzag encoded.
+  {
+    const std::vector<int64_t> ints = { 0, -1, 63, -64, 300, INT64_MIN, INT64_MAX };
+
+    IpcCall::Serializer raw(IpcCall::Format::Latest);
+    IpcCall::Serializer compact(IpcCall::Format::Latest);
+    compact.SetCompact(true);
+
+    raw << ints;
+    compact << ints << 70000;
+    assert(compact.Bytes().size() < raw.Bytes().size());
+
+    std::vector<int64_t> compactInts;
+    int16_t overflow;
+
+    IpcCall::Unserializer unserializer(compact.Bytes(), compact);
+    unserializer >> compactInts;
+    assert(compactInts == ints);
+
+    try {
+      unserializer >> overflow;
+      assert(false);
+    } catch (const std::runtime_error& e) {
+      assert(std::string(e.what()) == "IPC integer is out of range");
+    }
+  }
+
+  // Test 'Greet', a call with the same arguments is replied from the cache, with its 'out' parameter.
+  {
+    uint32_t inOut = 1;
+    assert(IPC_SEND_RECEIVE(Greet)("A", inOut)(IpcSync) == "Hello A" && inOut == 2);
+
+    inOut = 1;
+    assert(IPC_SEND_RECEIVE(Greet)("A", inOut)(IpcSync) == "Hello A" && inOut == 2);
+    assert(s_greetCalls == 1);
+
+    assert(IPC_SEND_RECEIVE(Greet)("A", inOut)(IpcSync) == "Hello A" && inOut == 3);
+    assert(s_greetCalls == 2);
+  }
+
+  // Test the keys of the cache, the same argument bytes in another encoding, or at another offset modulo the alignment
+  // of the request or of the reply, are other keys, so their replies don't replace each other.
+  {
+    IpcCall::ResultCache cache(100, {});
+
+    const IpcCall::bytes_t request = { 1, 2, 3 };
+    const IpcCall::bytes_t shiftedRequest = { 0, 0, 0, 0, 1, 2, 3 };
+
+    IpcCall::Unserializer plain(request, IpcCall::Format::Latest);
+    IpcCall::Unserializer compact(request, IpcCall::Format::Latest);
+    compact.SetCompact(true);
+
+    IpcCall::Unserializer shifted(shiftedRequest, IpcCall::Format::Latest);
+    uint32_t padding;
+    shifted >> padding;
+
+    const IpcCall::ResultCache::Key keys[] = {
+      IpcCall::ResultCache::Key::Of(plain, 0), IpcCall::ResultCache::Key::Of(compact, 0),
+      IpcCall::ResultCache::Key::Of(shifted, 0), IpcCall::ResultCache::Key::Of(plain, 8)
+    };
+
+    for (uint8_t i = 0; i < std::size(keys); i++) {
+      cache.Insert(keys[i], &i, 1);
+    }
+
+    for (uint8_t i = 0; i < std::size(keys); i++) {
+      IpcCall::Serializer reply(IpcCall::Format::Latest);
+      assert(cache.Find(keys[i], reply) && reply.Bytes() == IpcCall::bytes_t{ i });
+    }
+  }
+
+  // Test 'IPC_SERIALIZABLE' structs, they are serialized as their fields, with and without the compact encoding.
+  static_assert(IpcCall::IsPackedStruct<Reading>() && !IpcCall::IsPackedStruct<Sample>() && IpcCall::SerializedSize<Sample>::FixedSize == 13);
+
+  for (const bool compact : { false, true }) {
+    const Event event = { "Event", { { 1, -2, 0.5f }, { 2, 3, 1 } }, { { 3, 1.5f }, { 4, -2.5f } } };
+
+    IpcCall::Serializer serializer(IpcCall::Format::Latest);
+    serializer.SetCompact(compact);
+    serializer << event;
+
+    IpcCall::Serializer fields(IpcCall::Format::Latest);
+    fields.SetCompact(compact);
+    fields << event.name_ << event.samples_.size();
+    for (const auto& sample : event.samples_) {
+      fields << sample.kind_ << sample.time_ << sample.scale_;
+    }
+    fields << event.readings_.size();
+    for (const auto& reading : event.readings_) {
+      fields << reading.id_ << reading.value_;
+    }
+    assert(serializer.Bytes() == fields.Bytes());
+
+    Event result;
+
+    IpcCall::Unserializer unserializer(serializer.Bytes(), serializer);
+    unserializer >> result;
+
+    assert(result == event && unserializer.Available() == 0);
+  }
+
+  // Test container adapters, they are serialized as the underlying container.
+  {
+    std::stack<std::string> stack({ "A", "B", "C" });
+    std::queue<int> queue({ 1, 2, 3 });
+    std::priority_queue<int, std::vector<int>, std::greater<int>> priorityQueue;
+    for (int i : { 5, 1, 4, 2, 3 }) {
+      priorityQueue.push(i);
+    }
+
+    IpcCall::Serializer serializer(IpcCall::Format::Latest);
+    serializer << stack << queue << priorityQueue;
+
+    decltype(stack) stackResult;
+    decltype(queue) queueResult;
+    decltype(priorityQueue) priorityQueueResult;
+
+    IpcCall::Unserializer unserializer(serializer.Bytes(), serializer);
+    unserializer >> stackResult >> queueResult >> priorityQueueResult;
+
+    assert(stackResult == stack && stackResult.top() == "C");
+    assert(queueResult == queue && queueResult.front() == 1);
+
+    for (int i = 1; i <= 5; i++) {
+      assert(priorityQueueResult.top() == i);
+      priorityQueueResult.pop();
+    }
+  }
+
+  // Test associative containers with a custom comparator and multiple equal keys.
+  {
+    std::set<int, std::greater<int>> set = { 1, 3, 2 };
+    std::multimap<std::string, int> multimap = { { "A", 1 }, { "B", 2 }, { "A", 3 } };
+    std::unordered_multiset<std::string> unorderedMultiset = { "A", "B", "A" };
+
+    IpcCall::Serializer serializer(IpcCall::Format::Latest);
+    serializer << set << multimap << unorderedMultiset;
+
+    decltype(set) setResult;
+    decltype(multimap) multimapResult;
+    decltype(unorderedMultiset) unorderedMultisetResult;
+
+    IpcCall::Unserializer unserializer(serializer.Bytes(), serializer);
+    unserializer >> setResult >> multimapResult >> unorderedMultisetResult;
+
+    assert(setResult == set && *setResult.begin() == 3);
+    assert(multimapResult == multimap);
+    assert(unorderedMultisetResult == unorderedMultiset);
+  }
+
+  // Test deadlines.
+  {
+    // A call after its deadline is not sent.
+    {
+      IpcCall::Deadline deadline(std::chrono::nanoseconds(0));
+
+      try {
+        IPC_SEND_RECEIVE(Overrun)(false)(IpcSync);
+        assert(false);
+      } catch (const IpcCall::DeadlineExceeded&) {
+      }
+    }
+
+    assert(s_overrunCalls == 0);
+
+    if (IPC_CALL_FORMAT >= IpcCall::Format::Flags) {
+      // The reply of a call that runs past its deadline is not serialized, the deadline is far, so the call is executed.
+      {
+        IpcCall::Deadline deadline(std::chrono::seconds(10));
+
+        try {
+          IPC_SEND_RECEIVE(Overrun)(true)(IpcSync);
+          assert(false);
+        } catch (const IpcCall::DeadlineExceeded&) {
+        }
+      }
+
+      assert(s_overrunCalls == 1);
+
+      // A request carries the time that is left until its deadline, the server counts it from when the request is received.
+      // A request that is received after its deadline is not executed.
+      std::vector<uint8_t> request;
+      {
+        IpcCall::Deadline deadline(std::chrono::seconds(10));
+
+        const auto record = [&](const std::vector<uint8_t>& bytes) -> std::vector<uint8_t> {
+          request = bytes;
+          throw std::runtime_error("Recorded");
+        };
+
+        try {
+          IPC_SEND_RECEIVE(Overrun)(false)(record);
+        } catch (const std::runtime_error&) {
+        }
+      }
+
+      try {
+        IpcCall::Server::SyncCall(request, std::chrono::steady_clock::now() - std::chrono::seconds(11));
+        assert(false);
+      } catch (const IpcCall::DeadlineExceeded&) {
+      }
+
+      assert(s_overrunCalls == 1);
+
+      IpcCall::BufferPool::Release(IpcCall::Server::SyncCall(request));
+      assert(s_overrunCalls == 2);
+
+      // Nested IPC calls of a function have the deadline of its request, it is counted from when the request is received,
+      // so it is later by the time that the requests are in transit.
+      {
+        IpcCall::Deadline deadline(std::chrono::seconds(10));
+
+        const auto nested = IPC_SEND_RECEIVE(NestedDeadline)()(IpcThread);
+        assert(nested >= IpcCall::Deadline::Current() && nested - IpcCall::Deadline::Current() < 1000000000);
+      }
+
+      assert(IPC_SEND_RECEIVE(NestedDeadline)()(IpcThread) == 0);
+    }
+  }
+
+#if IPC_CALL_METRICS
+  // Test metrics of the server, they are returned by the built-in function 'IpcCallMetrics'.
+  {
+    const auto metrics = IPC_SEND_RECEIVE(IpcCallMetrics)()(IpcSync);
+
+    const auto count = std::find_if(metrics.begin(), metrics.end(), [](const auto& f) { return f.name == "Count"; });
+    assert(count != metrics.end() && count->calls >= 1 && count->requestBytes > 0 && count->replyBytes > 0);
+    assert(count->errors == (IPC_CALL_FORMAT >= IpcCall::Format::Flags ? 1u : 0u));
+
+    // The first call on the thread is timed.
+    uint64_t timed = 0;
+    for (const auto& f : metrics) {
+      timed += f.decode.Count();
+    }
+    assert(timed > 0);
+
+    const auto greet = std::find_if(metrics.begin(), metrics.end(), [](const auto& f) { return f.name == "Greet"; });
+    assert(greet != metrics.end() && greet->cacheHits == 1 && greet->cacheMisses == 2);
+
+    // Dropped after execution, and before unserialization.
+    const auto overrun = std::find_if(metrics.begin(), metrics.end(), [](const auto& f) { return f.name == "Overrun"; });
+    assert(overrun != metrics.end() && overrun->expired == (IPC_CALL_FORMAT >= IpcCall::Format::Flags ? 2u : 0u) && overrun->errors == 0);
+  }
+#endif
+
   std::cout << "!!!\n";
 }
 
@@ -104,3 +572,75 @@ std::list<Data> XYZ(const std::map<std::string, int>& in, std::vector<std::tuple
   return ret;
 }
 IPC_CALL_REGISTER(XYZ);
+
+// 'Sum' implementation.
+// Returns the sum of 'points' scaled by 'inOut', and doubles 'inOut'.
+Point Sum(const std::vector<Point>& points, std::array<double, 2>& inOut) {
+  Point ret = { 0, 0 };
+
+  for (const auto& point : points) {
+    ret.x_ += point.x_ * inOut[0];
+    ret.y_ += point.y_ * inOut[1];
+  }
+
+  inOut = { inOut[0] * 2, inOut[1] * 2 };
+
+  return ret;
+}
+IPC_CALL_REGISTER(Sum);
+
+// 'Count' implementation.
+size_t Count(std::wstring_view text, wchar_t c) {
+  if (text.empty()) {
+    throw std::runtime_error("Empty text");
+  }
+
+  return std::count(text.begin(), text.end(), c);
+}
+IPC_CALL_REGISTER(Count);
+
+// 'Greet' implementation, it is pure, up to 100 replies are cached for a minute.
+std::string Greet(const std::string& name, uint32_t& inOut) {
+  s_greetCalls++;
+
+  inOut++;
+
+  return "Hello " + name;
+}
+IPC_CALL_REGISTER_CACHED(Greet, 100, std::chrono::minutes(1));
+
+#ifdef __cpp_lib_span
+// 'Average' implementation.
+double Average(std::span<const double> values) {
+  double sum = 0;
+
+  for (auto value : values) {
+    sum += value;
+  }
+
+  return sum / values.size();
+}
+IPC_CALL_REGISTER(Average);
+#endif
+
+// 'Overrun' implementation, the deadline of the call is moved to the past, as if the call took longer than it.
+int Overrun(bool overrun) {
+  if (overrun) {
+    IpcCall::Deadline::Current() = 1;
+  }
+
+  return ++s_overrunCalls;
+}
+IPC_CALL_REGISTER(Overrun);
+
+// 'NestedDeadline' implementation.
+uint64_t NestedDeadline() {
+  return IPC_SEND_RECEIVE(CurrentDeadline)()(IpcThread);
+}
+IPC_CALL_REGISTER(NestedDeadline);
+
+// 'CurrentDeadline' implementation.
+uint64_t CurrentDeadline() {
+  return IpcCall::Deadline::Current();
+}
+IPC_CALL_REGISTER(CurrentDeadline);
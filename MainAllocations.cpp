@@ -0,0 +1,154 @@
+// Heap allocations of unserialization and of the call path, counted by the replaced 'operator new'.
+
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "IpcCallClient.h"
+#include "IpcCallServer.h"
+
+static std::atomic<uint64_t> s_allocations;
+
+void* operator new(size_t size) {
+  s_allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+
+  throw std::bad_alloc();
+}
+
+// GCC warns about 'free' of a pointer from 'operator new', they are replaced together.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+// Allocations of 'f'.
+template <typename F>
+static uint64_t Allocations(F&& f) {
+  const uint64_t allocations = s_allocations.load(std::memory_order_relaxed);
+
+  f();
+
+  return s_allocations.load(std::memory_order_relaxed) - allocations;
+}
+
+// Allocations of unserialization of 'value', the result is compared with 'value'.
+template <typename T>
+static uint64_t UnserializeAllocations(const T& value, bool compact) {
+  IpcCall::Serializer serializer(IpcCall::Format::Latest);
+  serializer.SetCompact(compact);
+  serializer << value;
+
+  T result;
+
+  const auto allocations = Allocations([&] {
+    IpcCall::Unserializer unserializer(serializer.Bytes(), serializer);
+    unserializer >> result;
+  });
+
+  assert(result == value);
+
+  return allocations;
+}
+
+// Longer than the small string buffer, every string is an allocation.
+static std::string LongString(size_t i) {
+  return "String longer than the small string buffer " + std::to_string(i);
+}
+
+// Functions of the call path, they differ only in how the parameter is passed.
+size_t LengthByValue(std::string s);
+size_t LengthByReference(const std::string& s);
+
+static std::vector<uint8_t> IpcSync(const std::vector<uint8_t>& bytes) {
+  return IpcCall::Server::SyncCall(bytes);
+}
+
+int main() {
+  constexpr size_t N = 100;
+
+  std::vector<std::string> strings;
+  std::list<std::string> list;
+  std::forward_list<std::string> forwardList;
+  std::set<std::string> set;
+  std::map<std::string, std::string> map;
+  std::unordered_map<int, int> unorderedMap;
+  std::vector<int> ints;
+
+  for (size_t i = 0; i < N; i++) {
+    strings.push_back(LongString(i));
+    list.push_back(LongString(i));
+    forwardList.push_front(LongString(i));
+    set.insert(LongString(i));
+    map.emplace(LongString(i), LongString(i));
+    ints.push_back(static_cast<int>(i));
+    unorderedMap.emplace(static_cast<int>(i), static_cast<int>(i));
+  }
+
+  for (const bool compact : { false, true }) {
+    // The buffer, then every string is unserialized in place.
+    assert(UnserializeAllocations(strings, compact) == N + 1);
+
+    // Only the buffer.
+    assert(UnserializeAllocations(ints, compact) == 1);
+
+    // A node and a string per element.
+    assert(UnserializeAllocations(list, compact) == 2 * N);
+    assert(UnserializeAllocations(forwardList, compact) == 2 * N);
+
+    // A node and a string per element, the string is moved into the node.
+    assert(UnserializeAllocations(set, compact) == 2 * N);
+
+    // A node, a key and a value per element.
+    assert(UnserializeAllocations(map, compact) == 3 * N);
+
+    // The buckets once, then a node per element.
+    assert(UnserializeAllocations(unorderedMap, compact) == N + 1);
+  }
+
+  // An argument of a parameter by value is not copied, by the client or by the server.
+  const std::string s = LongString(0);
+
+  IPC_SEND_RECEIVE(LengthByValue)(s)(IpcSync);
+  IPC_SEND_RECEIVE(LengthByReference)(s)(IpcSync);
+
+  const auto byValue = Allocations([&] {
+    assert(IPC_SEND_RECEIVE(LengthByValue)(s)(IpcSync) == s.size());
+  });
+
+  const auto byReference = Allocations([&] {
+    assert(IPC_SEND_RECEIVE(LengthByReference)(s)(IpcSync) == s.size());
+  });
+
+  assert(byValue == byReference);
+
+  std::cout << "Unserialization of vector<string>[" << N << "]: " << UnserializeAllocations(strings, false) << " allocations\n";
+  std::cout << "IPC_SEND_RECEIVE with a string argument: " << byValue << " allocations\n";
+}
+
+
+//
+// Server
+//
+
+size_t LengthByValue(std::string s) {
+  return s.size();
+}
+IPC_CALL_REGISTER(LengthByValue);
+
+size_t LengthByReference(const std::string& s) {
+  return s.size();
+}
+IPC_CALL_REGISTER(LengthByReference);
@@ -0,0 +1,342 @@
+// Benchmarks of serialization of the supported containers, and of the call path over an in-process loopback transport.
+// Every line reports time per operation, throughput and heap allocations per operation.
+//
+// Usage: ipccall_bench [milliseconds per measurement]
+
+#include <iostream>
+#include <iomanip>
+#include <cassert>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "IpcCallClient.h"
+#include "IpcCallServer.h"
+
+// Heap allocations of the process, counted by the replaced 'operator new'.
+static std::atomic<uint64_t> s_allocations;
+
+void* operator new(size_t size) {
+  s_allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+
+  throw std::bad_alloc();
+}
+
+// GCC warns about 'free' of a pointer from 'operator new', they are replaced together.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+// Custom struct that is serialized field by field.
+struct Person {
+  std::string name_;
+  uint32_t age_;
+};
+
+// Custom struct that opts in to serialization as raw bytes.
+struct Point {
+  double x_;
+  double y_;
+};
+
+template <> struct IpcCall::TriviallySerializable<Point>: std::true_type {};
+
+// Custom structs that are declared by 'IPC_SERIALIZABLE', without and with padding.
+struct Reading {
+  uint32_t id_;
+  float value_;
+};
+
+struct Sample {
+  uint8_t kind_;
+  int64_t time_;
+  float scale_;
+};
+
+IPC_SERIALIZABLE(Reading, id_, value_);
+IPC_SERIALIZABLE(Sample, kind_, time_, scale_);
+
+namespace IpcCall {
+  Serializer& operator << (Serializer& serializer, const Person& person) {
+    return serializer << person.name_ << person.age_;
+  }
+
+  Unserializer& operator >> (Unserializer& unserializer, Person& person) {
+    return unserializer >> person.name_ >> person.age_;
+  }
+
+  template <>
+  struct SerializedSize<Person> {
+    static constexpr bool Fixed = false;
+    static constexpr size_t FixedSize = 0;
+
+    static size_t Size(const Person& person, Format format) {
+      return SizeOf(person.name_, format) + SizeOf(person.age_, format);
+    }
+  };
+}
+
+static std::chrono::duration<double> s_duration = std::chrono::milliseconds(100);
+
+struct Result {
+  double ns;          // Per operation.
+  double allocations; // Per operation.
+};
+
+// Runs 'f' in rounds of doubling iterations until a round takes 's_duration'.
+template <typename F>
+static Result Measure(F&& f) {
+  f();
+
+  for (uint64_t iterations = 1; ; iterations *= 2) {
+    const uint64_t allocations = s_allocations.load(std::memory_order_relaxed);
+    const auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < iterations; i++) {
+      f();
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (elapsed >= s_duration || iterations >= (1ull << 40)) {
+      return { elapsed.count() * 1e9 / iterations, static_cast<double>(s_allocations.load(std::memory_order_relaxed) - allocations) / iterations };
+    }
+  }
+}
+
+static void Print(const std::string& name, const char* operation, size_t bytes, const Result& result) {
+  std::cout << std::left << std::setw(52) << name << std::setw(12) << operation << std::right << std::fixed
+            << std::setw(10) << bytes << " B"
+            << std::setw(14) << std::setprecision(1) << result.ns << " ns/op"
+            << std::setw(12) << std::setprecision(1) << bytes * 1e3 / result.ns << " MB/s"
+            << std::setw(10) << std::setprecision(2) << result.allocations << " allocs/op\n";
+}
+
+// Serializes and unserializes 'value' that is produced by 'make(size)' for every size.
+template <typename T, typename Make>
+static void BenchContainer(const std::string& name, Make&& make) {
+  for (const size_t size : { 16, 1024, 65536 }) {
+    const T value = make(size);
+
+    IpcCall::Serializer serializer(IpcCall::Format::Latest);
+
+    const auto serialize = Measure([&] {
+      serializer = IpcCall::Serializer(serializer.Release(), IpcCall::Format::Latest);
+      serializer << value;
+    });
+
+    const auto unserialize = Measure([&] {
+      IpcCall::Unserializer unserializer(serializer.Bytes(), IpcCall::Format::Latest);
+
+      T result;
+      unserializer >> result;
+
+      assert(unserializer.Available() == 0);
+    });
+
+    const std::string label = name + " [" + std::to_string(size) + "]";
+
+    Print(label, "serialize", serializer.Bytes().size(), serialize);
+    Print(label, "unserialize", serializer.Bytes().size(), unserialize);
+  }
+}
+
+template <typename T>
+static T Sequence(size_t size) {
+  T ret;
+  for (size_t i = 0; i < size; i++) {
+    ret.push_back(static_cast<typename T::value_type>(i));
+  }
+
+  return ret;
+}
+
+template <typename T>
+static T Adapter(size_t size) {
+  T ret;
+  for (size_t i = 0; i < size; i++) {
+    ret.push(static_cast<typename T::value_type>(i));
+  }
+
+  return ret;
+}
+
+// Functions of the call path benchmark.
+int Add(int a, int b);
+std::string Echo(const std::string& s);
+double Total(const std::vector<double>& values);
+void Notify(uint32_t n);
+
+// Loopback transports, they call the server directly.
+static std::vector<uint8_t> IpcSync(const std::vector<uint8_t>& bytes) {
+  return IpcCall::Server::SyncCall(bytes);
+}
+
+static void IpcAsync(const std::vector<uint8_t>& bytes) {
+  IpcCall::Server::AsyncCall(bytes);
+}
+
+static void IpcFuture(const std::vector<uint8_t>& bytes, IpcCall::call_id_t, IpcCall::Completion completion) {
+  completion(IpcCall::Server::SyncCall(bytes), nullptr);
+}
+
+// Request and reply size of a call of 'Add', to report throughput.
+static size_t CallBytes(size_t reply) {
+  size_t request = 0;
+  IPC_SEND_RECEIVE(Add)(1, 2)([&](const std::vector<uint8_t>& bytes) {
+    request = bytes.size();
+    return IpcSync(bytes);
+  });
+
+  return request + reply;
+}
+
+static uint64_t s_notified;
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    s_duration = std::chrono::milliseconds(std::stoi(argv[1]));
+  }
+
+  // Serialization.
+  BenchContainer<std::vector<int>>("vector<int>", Sequence<std::vector<int>>);
+  BenchContainer<std::vector<double>>("vector<double>", Sequence<std::vector<double>>);
+  BenchContainer<std::list<int>>("list<int>", Sequence<std::list<int>>);
+  BenchContainer<std::deque<int>>("deque<int>", Sequence<std::deque<int>>);
+
+  BenchContainer<std::set<int>>("set<int>", [](size_t size) {
+    std::set<int> ret;
+    for (size_t i = 0; i < size; i++) {
+      ret.insert(static_cast<int>(i));
+    }
+
+    return ret;
+  });
+
+  BenchContainer<std::unordered_map<int, int>>("unordered_map<int, int>", [](size_t size) {
+    std::unordered_map<int, int> ret;
+    for (size_t i = 0; i < size; i++) {
+      ret.emplace(static_cast<int>(i), static_cast<int>(i));
+    }
+
+    return ret;
+  });
+
+  BenchContainer<std::vector<std::tuple<int, double, std::string>>>("vector<tuple<int, double, string>>", [](size_t size) {
+    std::vector<std::tuple<int, double, std::string>> ret;
+    for (size_t i = 0; i < size; i++) {
+      ret.emplace_back(static_cast<int>(i), static_cast<double>(i), "Tuple");
+    }
+
+    return ret;
+  });
+
+  BenchContainer<std::string>("string", [](size_t size) { return std::string(size, 'A'); });
+  BenchContainer<std::wstring>("wstring", [](size_t size) { return std::wstring(size, L'A'); });
+
+  BenchContainer<std::stack<int>>("stack<int>", Adapter<std::stack<int>>);
+  BenchContainer<std::priority_queue<int>>("priority_queue<int>", Adapter<std::priority_queue<int>>);
+
+  BenchContainer<std::vector<Person>>("vector<Person> (custom operators)", [](size_t size) {
+    return std::vector<Person>(size, Person{ "Person", 42 });
+  });
+
+  BenchContainer<std::vector<Point>>("vector<Point> (trivially serializable)", [](size_t size) {
+    return std::vector<Point>(size, Point{ 1, 2 });
+  });
+
+  BenchContainer<std::vector<Reading>>("vector<Reading> (IPC_SERIALIZABLE, packed)", [](size_t size) {
+    return std::vector<Reading>(size, Reading{ 1, 2 });
+  });
+
+  BenchContainer<std::vector<Sample>>("vector<Sample> (IPC_SERIALIZABLE, padded)", [](size_t size) {
+    return std::vector<Sample>(size, Sample{ 1, 2, 3 });
+  });
+
+  // Call path, a call is serialization of the request, the server call and unserialization of the reply.
+  std::cout << '\n';
+
+  const size_t addBytes = CallBytes(sizeof(int));
+
+  Print("IPC_SEND_RECEIVE(Add)", "loopback", addBytes, Measure([] {
+    const int res = IPC_SEND_RECEIVE(Add)(1, 2)(IpcSync);
+    assert(res == 3);
+    (void)res;
+  }));
+
+  Print("IPC_CALL_FUTURE(Add)", "loopback", addBytes, Measure([] {
+    const int res = IPC_CALL_FUTURE(Add)(1, 2)(IpcFuture).get();
+    assert(res == 3);
+    (void)res;
+  }));
+
+  Print("IPC_SEND(Notify)", "loopback", sizeof(uint32_t), Measure([] {
+    IPC_SEND(Notify)(1)(IpcAsync);
+  }));
+
+  for (const size_t size : { 16, 1024, 65536 }) {
+    const std::string s(size, 'A');
+
+    Print("IPC_SEND_RECEIVE(Echo) [" + std::to_string(size) + "]", "loopback", 2 * size, Measure([&] {
+      const auto res = IPC_SEND_RECEIVE(Echo)(s)(IpcSync);
+      assert(res.size() == s.size());
+      (void)res;
+    }));
+  }
+
+  for (const size_t size : { 16, 1024, 65536 }) {
+    const auto values = Sequence<std::vector<double>>(size);
+
+    Print("IPC_SEND_RECEIVE(Total) [" + std::to_string(size) + "]", "loopback", size * sizeof(double), Measure([&] {
+      const double res = IPC_SEND_RECEIVE(Total)(values)(IpcSync);
+      assert(res == size * (size - 1) / 2.0);
+      (void)res;
+    }));
+  }
+
+  assert(s_notified > 0);
+}
+
+
+//
+// Server
+//
+
+int Add(int a, int b) {
+  return a + b;
+}
+IPC_CALL_REGISTER(Add);
+
+std::string Echo(const std::string& s) {
+  return s;
+}
+IPC_CALL_REGISTER(Echo);
+
+double Total(const std::vector<double>& values) {
+  double ret = 0;
+
+  for (auto value : values) {
+    ret += value;
+  }
+
+  return ret;
+}
+IPC_CALL_REGISTER(Total);
+
+void Notify(uint32_t n) {
+  s_notified += n;
+}
+IPC_CALL_REGISTER(Notify);
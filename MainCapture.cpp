@@ -0,0 +1,232 @@
+// Capture of the requests of several threads, the capture overhead, and replay of the capture.
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "IpcCallClient.h"
+#include "IpcCallCapture.h"
+
+int Add(int a, int b);
+void Notify(uint32_t n);
+std::string Echo(const std::string& s);
+int Divide(int a, int b);
+
+static std::atomic<uint64_t> s_notified;
+
+static std::vector<uint8_t> IpcSync(const std::vector<uint8_t>& bytes) {
+  return IpcCall::Server::SyncCall(bytes);
+}
+
+static void IpcAsync(const std::vector<uint8_t>& bytes) {
+  IpcCall::Server::AsyncCall(bytes);
+}
+
+// Nanoseconds per synchronous call.
+static double MeasureCalls(int count) {
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < count; i++) {
+    IPC_SEND_RECEIVE(Add)(i, 1)(IpcSync);
+  }
+
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+// Requests of a thread: 'count' iterations of 'Add', 'Echo', 'Notify' and 'Divide', and a batch.
+static void Traffic(int thread, int count) {
+  for (int i = 0; i < count; i++) {
+    assert(IPC_SEND_RECEIVE(Add)(thread, i)(IpcSync) == thread + i);
+    assert(IPC_SEND_RECEIVE(Echo)(std::to_string(i))(IpcSync) == std::to_string(i));
+    IPC_SEND(Notify)(1)(IpcAsync);
+
+    // A division by zero throws.
+    try {
+      IPC_SEND_RECEIVE(Divide)(i, i % 10)(IpcSync);
+      assert(i % 10 != 0);
+    } catch (const std::exception&) {
+      assert(i % 10 == 0);
+    }
+  }
+
+  IpcCall::Batch batch;
+  auto sum = IPC_CALL_FUTURE(Add)(1, 2)(batch.Future());
+  auto echo = IPC_CALL_FUTURE(Echo)("batch")(batch.Future());
+  batch.Send(IpcSync);
+
+  assert(sum.get() == 3);
+  assert(echo.get() == "batch");
+}
+
+static void Print(const char* name, const IpcCall::Replay::Result& result) {
+  std::cout << std::left << std::setw(24) << name << std::right
+            << result.calls << " calls in " << std::chrono::duration<double, std::milli>(result.elapsed).count() << " ms"
+            << ", p50 " << result.latency.Percentile(0.5) << " ns, p99 " << result.latency.Percentile(0.99) << " ns\n";
+}
+
+int main(int argc, char* argv[]) {
+  const int count = argc > 1 ? std::atoi(argv[1]) : 10000;
+  const std::string path = argc > 2 ? argv[2] : "/tmp/ipccall_capture_" + std::to_string(getpid()) + ".ipccap";
+
+  constexpr int Threads = 4;
+
+  // Warm up.
+  MeasureCalls(count);
+
+  const double plain = MeasureCalls(count);
+  double captured = 0;
+
+  {
+    IpcCall::Capture capture(path, 64 << 20, 64 << 10);
+    IpcCall::Server::SetRecorder(&capture);
+
+    captured = MeasureCalls(count);
+
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < Threads; thread++) {
+      threads.emplace_back(Traffic, thread, count / Threads);
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    // A call with a deadline, it is replayed after the deadline, the time that is left is counted from the replayed call.
+    {
+      IpcCall::Deadline deadline(std::chrono::milliseconds(20));
+      assert(IPC_SEND_RECEIVE(Add)(1, 1)(IpcSync) == 2);
+    }
+
+    IpcCall::Server::SetRecorder(nullptr);
+    capture.Close();
+
+    assert(capture.Dropped() == 0);
+  }
+
+  // 'Add' calls, then 4 requests per iteration and a batch per thread, and the call with a deadline.
+  const size_t frames = count + Threads * (count / Threads * 4 + 1) + 1;
+
+  // The replay is after the deadline of the captured call.
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+  IpcCall::Replay replay(path);
+  assert(replay.Frames().size() == frames);
+  assert(replay.Dropped() == 0);
+
+  // The frames are in the order of their times.
+  for (size_t i = 1; i < frames; i++) {
+    assert(replay.Frames()[i - 1].time <= replay.Frames()[i].time);
+  }
+
+  assert(replay.Frames().front().funcId == IpcCall::FunctionId("Add"));
+
+  // 'Divide' by zero throws in 'Server::SyncCall', it throws again in replay.
+  const auto failed = std::count_if(replay.Frames().begin(), replay.Frames().end(), [](const auto& frame) { return frame.failed; });
+  assert(failed == Threads * ((count / Threads + 9) / 10));
+
+  const auto notified = s_notified.load();
+
+  const auto fast = replay.Run(Threads, 0);
+  assert(fast.calls == frames);
+  assert(fast.errors == static_cast<uint64_t>(failed));
+  assert(fast.replyMismatches == 0);
+  assert(s_notified == notified + count / Threads * Threads);
+
+  // A frame is not issued before its time.
+  const auto paced = replay.Run(2, 1.0);
+  assert(paced.calls == frames);
+  assert(paced.errors == static_cast<uint64_t>(failed));
+  assert(paced.replyMismatches == 0);
+  assert(paced.elapsed >= replay.Frames().back().time);
+
+  // A capture that is closed while threads call, 'Close' stops recording and waits for the records in progress.
+  {
+    IpcCall::Capture capture(path, 64 << 20, 64 << 10);
+    IpcCall::Server::SetRecorder(&capture);
+
+    std::atomic<bool> stop{false};
+    std::atomic<int> calls{0};
+
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < Threads; thread++) {
+      threads.emplace_back([&] {
+        while (!stop) {
+          IPC_SEND_RECEIVE(Add)(1, 2)(IpcSync);
+          calls++;
+        }
+      });
+    }
+
+    while (calls < 1000) {
+      std::this_thread::yield();
+    }
+
+    capture.Close();
+
+    stop = true;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    assert(IpcCall::Replay(path).Frames().size() > 0);
+  }
+
+  // A file that is not a capture.
+  {
+    const int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+    const std::vector<char> garbage(2 * IpcCall::CaptureFile::HeaderSize, 'x');
+    const auto written = write(fd, garbage.data(), garbage.size());
+    close(fd);
+    assert(written == static_cast<ssize_t>(garbage.size()));
+
+    bool thrown = false;
+    try {
+      IpcCall::Replay corrupt(path);
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+
+    assert(thrown);
+  }
+
+  unlink(path.c_str());
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::left << std::setw(24) << "Call without capture:" << std::right << plain << " ns\n";
+  std::cout << std::left << std::setw(24) << "Call with capture:" << std::right << captured << " ns\n";
+  Print("Replay, as fast:", fast);
+  Print("Replay, original pace:", paced);
+}
+
+
+//
+// Server
+//
+
+int Add(int a, int b) {
+  return a + b;
+}
+IPC_CALL_REGISTER(Add);
+
+void Notify(uint32_t n) {
+  s_notified += n;
+}
+IPC_CALL_REGISTER(Notify);
+
+std::string Echo(const std::string& s) {
+  return s;
+}
+IPC_CALL_REGISTER(Echo);
+
+int Divide(int a, int b) {
+  if (b == 0) {
+    throw std::invalid_argument("Division by zero");
+  }
+
+  return a / b;
+}
+IPC_CALL_REGISTER(Divide);
@@ -0,0 +1,64 @@
+// Size and CPU time of the raw and the compact encoding of integers.
+
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <random>
+
+#include "IpcCallData.h"
+
+template <typename T>
+static void Measure(const char* name, const std::vector<T>& values, int count) {
+  for (const bool compact : { false, true }) {
+    IpcCall::Serializer serializer(IpcCall::Format::Latest);
+    serializer.SetCompact(compact);
+
+    std::vector<T> result;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < count; i++) {
+      serializer = IpcCall::Serializer(serializer.Release(), IpcCall::Format::Latest);
+      serializer.SetCompact(compact);
+
+      serializer << values;
+
+      IpcCall::Unserializer unserializer(serializer.Bytes(), serializer);
+      unserializer >> result;
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    assert(result == values);
+
+    const double ns = std::chrono::duration<double, std::nano>(elapsed).count() / count / values.size();
+
+    std::cout << name << (compact ? ", compact: " : ", raw: ") << serializer.Bytes().size() << " bytes, " << ns << " ns per value\n";
+  }
+}
+
+int main(int argc, char** argv) {
+  const int count = argc > 1 ? std::stoi(argv[1]) : 2000;
+  constexpr size_t Size = 1000;
+
+  std::mt19937_64 random(1);
+
+  std::vector<uint32_t> small(Size);
+  std::vector<int64_t> signedSmall(Size);
+  std::vector<uint64_t> large(Size);
+
+  for (size_t i = 0; i < Size; i++) {
+    small[i] = random() % 128;
+    signedSmall[i] = static_cast<int64_t>(random() % 128) - 64;
+    large[i] = random();
+  }
+
+  // 1-byte varints, the common case.
+  Measure("uint32_t below 128", small, count);
+
+  // 1-byte zigzag varints.
+  Measure("int64_t from -64 to 63", signedSmall, count);
+
+  // 10-byte varints, the worst case.
+  Measure("random uint64_t", large, count);
+}
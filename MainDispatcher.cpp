@@ -0,0 +1,246 @@
+// Admission of 'IpcCall::Dispatcher', and its throughput from 1 to N worker threads.
+
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "IpcCallClient.h"
+#include "IpcCallDispatcher.h"
+
+// 'Work' declaration, used in asynchronous call.
+void Work(uint32_t iterations);
+
+// 'Square' declaration, used in synchronous call.
+uint64_t Square(uint32_t iterations, uint64_t n);
+
+// 'Hold' declaration, a call returns when the calls are not held.
+uint32_t Hold(uint32_t id);
+
+static std::atomic<uint64_t> s_done;
+
+static std::mutex s_holdMutex;
+static std::condition_variable s_holdCondition;
+static bool s_held = false;
+
+static void SetHeld(bool held) {
+  {
+    std::lock_guard<std::mutex> lock(s_holdMutex);
+    s_held = held;
+  }
+
+  s_holdCondition.notify_all();
+}
+
+// Admission of 'Hold' calls, it is registered with 1 call in flight and 2 queued.
+static void TestAdmission() {
+  std::vector<uint8_t> holdRequest;
+  const auto record = [&](const std::vector<uint8_t>& bytes) {
+    holdRequest = bytes;
+    return IpcCall::Server::SyncCall(bytes);
+  };
+  assert(IPC_SEND_RECEIVE(Hold)(1)(record) == 1);
+
+  std::atomic<int> completed = 0;
+  std::atomic<int> overloaded = 0;
+
+  const auto completion = [&](std::vector<uint8_t>&&, std::exception_ptr error) {
+    try {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+
+      completed++;
+    } catch (const IpcCall::Overloaded&) {
+      overloaded++;
+    }
+  };
+
+  const auto submit = [&](IpcCall::Dispatcher& dispatcher) { dispatcher.SyncCall(std::vector<uint8_t>(holdRequest), completion); };
+
+  // Reject, a call executes, 2 are queued, the 4th fails.
+  {
+    SetHeld(true);
+
+    IpcCall::Dispatcher dispatcher(2);
+
+    for (int i = 0; i < 4; i++) {
+      submit(dispatcher);
+    }
+
+    const auto stats = dispatcher.Stats("Hold");
+    assert(stats.inFlight == 1 && stats.queued == 2 && stats.rejected == 1);
+    assert(overloaded == 1);
+
+    SetHeld(false);
+  }
+
+  assert(completed == 3);
+
+  // Drop the oldest, the second call is replaced by the third.
+  {
+    SetHeld(true);
+
+    IpcCall::Dispatcher dispatcher(2);
+    dispatcher.SetLimits("Hold", { 1, 1, IpcCall::Overload::DropOldest });
+
+    for (int i = 0; i < 3; i++) {
+      submit(dispatcher);
+    }
+
+    const auto stats = dispatcher.Stats("Hold");
+    assert(stats.inFlight == 1 && stats.queued == 1 && stats.dropped == 1);
+    assert(overloaded == 2);
+
+    SetHeld(false);
+  }
+
+  assert(completed == 5);
+
+  // All calls, 1 call waits for the worker that executes a call.
+  {
+    SetHeld(true);
+
+    IpcCall::Dispatcher dispatcher(1, 1);
+
+    submit(dispatcher);
+    while (dispatcher.Stats().inFlight == 0) {
+      std::this_thread::yield();
+    }
+
+    submit(dispatcher);
+    submit(dispatcher);
+
+    const auto stats = dispatcher.Stats();
+    assert(stats.inFlight == 1 && stats.queued == 1 && stats.rejected == 1);
+    assert(overloaded == 3);
+
+    SetHeld(false);
+  }
+
+  assert(completed == 7);
+
+  // Block, the submitting thread waits until the call in flight completes.
+  {
+    SetHeld(true);
+
+    IpcCall::Dispatcher dispatcher(2);
+    dispatcher.SetLimits("Hold", { 1, 0, IpcCall::Overload::Block });
+
+    submit(dispatcher);
+
+    std::atomic<bool> submitted = false;
+    std::thread transport([&] {
+      submit(dispatcher);
+      submitted = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(!submitted);
+
+    SetHeld(false);
+    transport.join();
+  }
+
+  assert(completed == 9 && overloaded == 3);
+}
+
+int main(int argc, char** argv) {
+  const uint32_t iterations = argc > 1 ? std::stoul(argv[1]) : 2000;
+  const int count = argc > 2 ? std::stoi(argv[2]) : 200000;
+  const size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  TestAdmission();
+
+  std::cout << "Calls of " << iterations << " iterations, " << maxThreads << " CPUs\n";
+
+  // Request of 'Square', it is recorded by the transport.
+  std::vector<uint8_t> squareRequest;
+  const auto record = [&](const std::vector<uint8_t>& bytes) {
+    squareRequest = bytes;
+    return IpcCall::Server::SyncCall(bytes);
+  };
+  assert(IPC_SEND_RECEIVE(Square)(iterations, 3)(record) == 9);
+
+  for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+    IpcCall::Dispatcher dispatcher(threads);
+
+    // 'IPC_SEND' transport passes requests to 'dispatcher'.
+    const auto ipcAsync = [&](const std::vector<uint8_t>& bytes) { dispatcher.AsyncCall(std::vector<uint8_t>(bytes)); };
+
+    std::atomic<uint64_t> replies = 0;
+
+    s_done = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Half of calls are asynchronous, half are synchronous with a completion.
+    for (int i = 0; i < count; i++) {
+      if (i % 2) {
+        IPC_SEND(Work)(iterations)(ipcAsync);
+      } else {
+        dispatcher.SyncCall(std::vector<uint8_t>(squareRequest), [&](std::vector<uint8_t>&& reply, std::exception_ptr error) {
+          assert(!error && reply.size() == sizeof(uint64_t));
+          (void)error;
+          (void)reply;
+
+          replies++;
+        });
+      }
+    }
+
+    while (s_done < static_cast<uint64_t>(count) || replies < static_cast<uint64_t>((count + 1) / 2)) {
+      std::this_thread::yield();
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << threads << " threads: " << static_cast<uint64_t>(count / elapsed.count()) << " calls/s\n";
+  }
+}
+
+
+//
+// Server
+//
+
+static uint64_t Spin(uint32_t iterations) {
+  uint64_t x = iterations;
+  for (uint32_t i = 0; i < iterations; i++) {
+    x = x * 6364136223846793005ull + 1442695040888963407ull;
+  }
+
+  return x;
+}
+
+// 'Work' implementation.
+void Work(uint32_t iterations) {
+  volatile uint64_t x = Spin(iterations);
+  (void)x;
+
+  s_done++;
+}
+IPC_CALL_REGISTER(Work);
+
+// 'Square' implementation.
+uint64_t Square(uint32_t iterations, uint64_t n) {
+  volatile uint64_t x = Spin(iterations);
+  (void)x;
+
+  s_done++;
+
+  return n * n;
+}
+IPC_CALL_REGISTER(Square);
+
+// 'Hold' implementation.
+uint32_t Hold(uint32_t id) {
+  std::unique_lock<std::mutex> lock(s_holdMutex);
+  s_holdCondition.wait(lock, [] { return !s_held; });
+
+  return id;
+}
+IPC_CALL_REGISTER_LIMITED(Hold, 1, 2);
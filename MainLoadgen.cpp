@@ -0,0 +1,389 @@
+// End-to-end load generator, callers drive registered functions through a transport, throughput and latency percentiles are reported.
+//
+//   ipccall_loadgen [--transport=loopback|shm|socket] [--callers=4] [--rate=0] [--duration=5]
+//                   [--payload=int|string|vector|map|struct] [--size=64] [--workers=0]
+//
+// '--rate' 0 is closed loop, every caller sends the next call when the reply of the previous call is received.
+// Otherwise it is open loop, 'rate' calls per second are scheduled evenly between the callers, and the latency of a call
+// is from its scheduled time, so the calls that wait for a stalled call are not omitted (coordinated omission).
+// '--size' is the number of bytes of 'string', and of elements of 'vector', 'map' and 'struct' payloads.
+// The shared memory and socket servers run in the parent process and the callers in a child process,
+// '--workers' is the number of 'Dispatcher' threads of the socket server, 0 executes calls on its event loop.
+// The exit code is 1 if a call failed.
+
+#include <iostream>
+#include <iomanip>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#include <sys/wait.h>
+
+#include "IpcCallClient.h"
+#include "IpcCallShm.h"
+#include "IpcCallSocket.h"
+
+struct Sample {
+  uint64_t time;
+  double value;
+  uint32_t sensor;
+};
+IPC_SERIALIZABLE(Sample, time, value, sensor);
+
+int Add(int a, int b);
+std::string EchoString(const std::string& s);
+std::vector<int> EchoVector(const std::vector<int>& v);
+std::map<std::string, int> EchoMap(const std::map<std::string, int>& m);
+std::vector<Sample> EchoSamples(const std::vector<Sample>& samples);
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string transport = "loopback";
+  unsigned callers = 4;
+  double rate = 0;
+  double duration = 5;
+  std::string payload = "int";
+  size_t size = 64;
+  size_t workers = 0;
+};
+
+static Options Parse(int argc, char** argv) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+
+    const auto equal = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || equal == std::string::npos) {
+      throw std::invalid_argument("'" + arg + "' is not --name=value");
+    }
+
+    const auto name = arg.substr(2, equal - 2);
+    const auto value = arg.substr(equal + 1);
+
+    if (name == "transport") {
+      options.transport = value;
+    } else if (name == "callers") {
+      options.callers = std::stoul(value);
+    } else if (name == "rate") {
+      options.rate = std::stod(value);
+    } else if (name == "duration") {
+      options.duration = std::stod(value);
+    } else if (name == "payload") {
+      options.payload = value;
+    } else if (name == "size") {
+      options.size = std::stoul(value);
+    } else if (name == "workers") {
+      options.workers = std::stoul(value);
+    } else {
+      throw std::invalid_argument("Unknown option '" + name + "'");
+    }
+  }
+
+  if (options.transport != "loopback" && options.transport != "shm" && options.transport != "socket") {
+    throw std::invalid_argument("Unknown transport '" + options.transport + "'");
+  }
+
+  if (options.payload != "int" && options.payload != "string" && options.payload != "vector" &&
+      options.payload != "map" && options.payload != "struct") {
+    throw std::invalid_argument("Unknown payload '" + options.payload + "'");
+  }
+
+  if (options.callers == 0 || options.duration <= 0 || options.rate < 0) {
+    throw std::invalid_argument("'callers' and 'duration' should be positive, 'rate' can't be negative");
+  }
+
+  return options;
+}
+
+// Call of 'options.payload' through 'ipcSync', it returns false if the reply is not the argument.
+template <typename IpcSync>
+static std::function<bool()> MakeCall(const Options& options, IpcSync ipcSync) {
+  if (options.payload == "string") {
+    return [ipcSync, s = std::string(options.size, 'x')]() mutable {
+      return IPC_SEND_RECEIVE(EchoString)(s)(ipcSync) == s;
+    };
+  }
+
+  if (options.payload == "vector") {
+    std::vector<int> v(options.size);
+    for (size_t i = 0; i < v.size(); i++) {
+      v[i] = static_cast<int>(i);
+    }
+
+    return [ipcSync, v]() mutable { return IPC_SEND_RECEIVE(EchoVector)(v)(ipcSync) == v; };
+  }
+
+  if (options.payload == "map") {
+    std::map<std::string, int> m;
+    for (size_t i = 0; i < options.size; i++) {
+      m.emplace("Key " + std::to_string(i), static_cast<int>(i));
+    }
+
+    return [ipcSync, m]() mutable { return IPC_SEND_RECEIVE(EchoMap)(m)(ipcSync) == m; };
+  }
+
+  if (options.payload == "struct") {
+    std::vector<Sample> samples(options.size);
+    for (size_t i = 0; i < samples.size(); i++) {
+      samples[i] = { i, i * 0.5, static_cast<uint32_t>(i % 16) };
+    }
+
+    return [ipcSync, samples]() mutable { return IPC_SEND_RECEIVE(EchoSamples)(samples)(ipcSync).size() == samples.size(); };
+  }
+
+  return [ipcSync]() mutable { return IPC_SEND_RECEIVE(Add)(1, 2)(ipcSync) == 3; };
+}
+
+struct Result {
+  uint64_t calls = 0;
+  uint64_t errors = 0;
+  uint64_t maxNs = 0;
+  IpcCall::LatencyHistogram latency;
+};
+
+// Calls 'call' from 'start' for 'options.duration', 'index' is the caller of 'options.callers'.
+static void Caller(const Options& options, const std::function<bool()>& call, unsigned index, Clock::time_point start, Result& result) {
+  const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+
+  // Open loop, the callers take turns, a caller sends a call every 'interval'.
+  const bool open = options.rate > 0;
+  const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(open ? options.callers / options.rate : 0));
+  auto scheduled = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(open ? index / options.rate : 0));
+
+  std::this_thread::sleep_until(start);
+
+  while (true) {
+    Clock::time_point callStart;
+
+    if (open) {
+      if (scheduled >= end) {
+        break;
+      }
+
+      std::this_thread::sleep_until(scheduled);
+
+      callStart = scheduled;
+      scheduled += interval;
+    } else {
+      callStart = Clock::now();
+
+      if (callStart >= end) {
+        break;
+      }
+    }
+
+    bool ok = false;
+    try {
+      ok = call();
+    } catch (const std::exception&) {
+    }
+
+    const auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - callStart).count());
+
+    result.latency.Record(ns);
+    result.maxNs = std::max(result.maxNs, ns);
+    result.calls++;
+    result.errors += !ok;
+  }
+}
+
+// Runs the callers, 'makeSync(index)' is the 'IPC_SEND_RECEIVE' transport of a caller. Returns 1 if a call failed.
+template <typename MakeSync>
+static int Load(const Options& options, MakeSync&& makeSync) {
+  std::vector<std::function<bool()>> calls;
+  for (unsigned i = 0; i < options.callers; i++) {
+    calls.push_back(MakeCall(options, makeSync(i)));
+  }
+
+  // Warm up, connections are established and buffers are allocated.
+  for (const auto& call : calls) {
+    for (int i = 0; i < 100; i++) {
+      call();
+    }
+  }
+
+  std::vector<Result> results(options.callers);
+  std::vector<std::thread> threads;
+
+  // The callers start together.
+  const auto start = Clock::now() + std::chrono::milliseconds(10);
+
+  for (unsigned i = 0; i < options.callers; i++) {
+    threads.emplace_back(Caller, std::cref(options), std::cref(calls[i]), i, start, std::ref(results[i]));
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  Result total;
+  for (const auto& result : results) {
+    total.calls += result.calls;
+    total.errors += result.errors;
+    total.maxNs = std::max(total.maxNs, result.maxNs);
+    total.latency.Merge(result.latency);
+  }
+
+  const auto us = [](uint64_t ns) { return ns / 1000.0; };
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "Transport " << options.transport << ", " << options.callers << " callers, "
+            << (options.rate > 0 ? "open loop " + std::to_string(static_cast<uint64_t>(options.rate)) + " calls/s" : std::string("closed loop"))
+            << ", payload " << options.payload;
+  if (options.payload != "int") {
+    std::cout << "[" << options.size << "]";
+  }
+  std::cout << ", " << elapsed.count() << " s\n";
+
+  std::cout << "Calls: " << total.calls << ", errors: " << total.errors
+            << ", throughput: " << static_cast<uint64_t>(total.calls / elapsed.count()) << " calls/s\n";
+
+  std::cout << "Latency us: p50 " << us(total.latency.Percentile(0.5)) << ", p99 " << us(total.latency.Percentile(0.99))
+            << ", p99.9 " << us(total.latency.Percentile(0.999)) << ", max " << us(total.maxNs) << std::endl;
+
+  return total.errors || total.calls == 0 ? 1 : 0;
+}
+
+static int Wait(pid_t pid) {
+  int status;
+  waitpid(pid, &status, 0);
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+
+  try {
+    options = Parse(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n"
+              << "Usage: ipccall_loadgen [--transport=loopback|shm|socket] [--callers=4] [--rate=0] [--duration=5]\n"
+              << "                       [--payload=int|string|vector|map|struct] [--size=64] [--workers=0]\n";
+    return 2;
+  }
+
+  if (options.transport == "loopback") {
+    return Load(options, [](unsigned) {
+      return [](const std::vector<uint8_t>& bytes) { return IpcCall::Server::SyncCall(bytes); };
+    });
+  }
+
+  if (options.transport == "shm") {
+    // A channel is between one client and one server, every caller has its own.
+    std::vector<std::unique_ptr<IpcCall::ShmServer>> servers;
+    for (unsigned i = 0; i < options.callers; i++) {
+      servers.push_back(std::make_unique<IpcCall::ShmServer>("/ipccall-loadgen-" + std::to_string(getpid()) + "-" + std::to_string(i)));
+    }
+
+    const pid_t parent = getpid();
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+      std::vector<std::unique_ptr<IpcCall::ShmClient>> clients;
+      for (unsigned i = 0; i < options.callers; i++) {
+        clients.push_back(std::make_unique<IpcCall::ShmClient>("/ipccall-loadgen-" + std::to_string(parent) + "-" + std::to_string(i)));
+      }
+
+      const int ret = Load(options, [&](unsigned i) { return clients[i]->Sync(); });
+
+      // Closing the channels makes the servers return, the child doesn't destroy the copies of 'servers'.
+      clients.clear();
+      _exit(ret);
+    }
+
+    // A server returns when its client exits.
+    std::vector<std::thread> threads;
+    for (auto& server : servers) {
+      threads.emplace_back([&server] { server->Run(); });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    return Wait(pid);
+  }
+
+  // Unix domain socket, a connection per caller. The server is created after 'fork', 'Dispatcher' has threads.
+  const std::string path = "/tmp/ipccall-loadgen-" + std::to_string(getpid()) + ".sock";
+
+  const pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<std::unique_ptr<IpcCall::SocketClient>> clients;
+
+    for (unsigned i = 0; i < options.callers; i++) {
+      for (auto deadline = Clock::now() + std::chrono::seconds(5); ; ) {
+        try {
+          clients.push_back(std::make_unique<IpcCall::SocketClient>(path));
+          break;
+        } catch (const std::system_error&) {
+          if (Clock::now() > deadline) {
+            throw;
+          }
+
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+    }
+
+    const int ret = Load(options, [&](unsigned i) { return clients[i]->Sync(); });
+
+    clients.clear();
+    _exit(ret);
+  }
+
+  std::unique_ptr<IpcCall::Dispatcher> dispatcher;
+  if (options.workers) {
+    dispatcher = std::make_unique<IpcCall::Dispatcher>(options.workers);
+  }
+
+  IpcCall::SocketServer server(path, dispatcher.get());
+
+  // Stop the server when the callers exit.
+  int ret = 1;
+  std::thread waiter([&] {
+    ret = Wait(pid);
+    server.Stop();
+  });
+
+  server.Run();
+  waiter.join();
+
+  return ret;
+}
+
+
+//
+// Server
+//
+
+int Add(int a, int b) {
+  return a + b;
+}
+IPC_CALL_REGISTER(Add);
+
+std::string EchoString(const std::string& s) {
+  return s;
+}
+IPC_CALL_REGISTER(EchoString);
+
+std::vector<int> EchoVector(const std::vector<int>& v) {
+  return v;
+}
+IPC_CALL_REGISTER(EchoVector);
+
+std::map<std::string, int> EchoMap(const std::map<std::string, int>& m) {
+  return m;
+}
+IPC_CALL_REGISTER(EchoMap);
+
+std::vector<Sample> EchoSamples(const std::vector<Sample>& samples) {
+  return samples;
+}
+IPC_CALL_REGISTER(EchoSamples);
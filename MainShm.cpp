@@ -0,0 +1,380 @@
+// Shared memory and Unix domain socket transports between two processes, and their round trip latency.
+
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+#include <sys/wait.h>
+
+#include "IpcCallClient.h"
+#include "IpcCallShm.h"
+#include "IpcCallSocket.h"
+
+// 'Add' declaration, used in synchronous call.
+int Add(int a, int b);
+
+// 'Store' declaration, used in asynchronous call.
+void Store(const std::string& s);
+
+// 'Fail' declaration, it throws an exception that is not 'std::exception'.
+void Fail();
+
+using Record = std::tuple<std::string, int>;
+
+// 'Import' declaration, the client streams 'records' to the server.
+size_t Import(IpcCall::InStream<Record> records);
+
+// 'Export' declaration, the server streams 'count' records to the client.
+IpcCall::OutStream<Record> Export(int count);
+
+//
+// Client, it runs in a child process.
+//
+template <typename IpcSync>
+static double MeasureLatency(IpcSync&& ipcSync, int count) {
+  // Warm up.
+  for (int i = 0; i < count / 10; i++) {
+    IPC_SEND_RECEIVE(Add)(i, 1)(ipcSync);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < count; i++) {
+    const int res = IPC_SEND_RECEIVE(Add)(i, 1)(ipcSync);
+    assert(res == i + 1);
+    (void)res;
+  }
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  return std::chrono::duration<double, std::micro>(elapsed).count() / count;
+}
+
+// 'Fanout' pipelined calls are in flight at a time.
+template <typename IpcFuture>
+static double MeasurePipelinedLatency(IpcFuture&& ipcFuture, int count) {
+  constexpr int Fanout = 16;
+
+  std::vector<std::future<int>> futures;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < count; i += Fanout) {
+    for (int j = 0; j < Fanout; j++) {
+      futures.push_back(IPC_CALL_FUTURE(Add)(i + j, 1)(ipcFuture));
+    }
+
+    for (int j = 0; j < Fanout; j++) {
+      const int res = futures[j].get();
+      assert(res == i + j + 1);
+      (void)res;
+    }
+
+    futures.clear();
+  }
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  return std::chrono::duration<double, std::micro>(elapsed).count() / count;
+}
+
+// 'BatchSize' calls are sent in one message.
+template <typename IpcSync>
+static double MeasureBatchedLatency(IpcSync&& ipcSync, int count) {
+  constexpr int BatchSize = 16;
+
+  IpcCall::Batch batch;
+  std::vector<std::future<int>> futures;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < count; i += BatchSize) {
+    for (int j = 0; j < BatchSize; j++) {
+      futures.push_back(IPC_CALL_FUTURE(Add)(i + j, 1)(batch.Future()));
+    }
+
+    batch.Send(ipcSync);
+
+    for (int j = 0; j < BatchSize; j++) {
+      const int res = futures[j].get();
+      assert(res == i + j + 1);
+      (void)res;
+    }
+
+    futures.clear();
+  }
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  return std::chrono::duration<double, std::micro>(elapsed).count() / count;
+}
+
+static void ShmClientProcess(const std::string& name, unsigned spinCount, int count) {
+  IpcCall::ShmClient client(name, spinCount);
+
+  // Asynchronous call is followed by synchronous, so it is done when 'Add' returns.
+  IPC_SEND(Store)("QAZ")(client.Async());
+
+  const double latency = MeasureLatency(client.Sync(), count);
+
+  std::cout << "Shared memory (spin " << spinCount << "): " << latency << " us per round trip" << std::endl;
+
+  const double batchedLatency = MeasureBatchedLatency(client.Sync(), count);
+
+  std::cout << "Shared memory (spin " << spinCount << "), batched: " << batchedLatency << " us per call" << std::endl;
+}
+
+// The server replies with an error to a call that throws any exception, and closes the channel when a frame is larger than its maximum.
+static void ShmLimitsClientProcess(const std::string& name) {
+  IpcCall::ShmClient client(name);
+
+  try {
+    IPC_SEND_RECEIVE(Fail)()(client.Sync());
+    assert(false);
+  } catch (const std::runtime_error& e) {
+    assert(std::string(e.what()) == "IPC server error");
+  }
+
+  IPC_SEND(Fail)()(client.Async());
+  assert(IPC_SEND_RECEIVE(Add)(1, 2)(client.Sync()) == 3);
+
+  try {
+    IPC_SEND(Store)(std::string(8192, 'x'))(client.Async());
+    IPC_SEND_RECEIVE(Add)(1, 2)(client.Sync());
+    assert(false);
+  } catch (const IpcCall::ShmClosed&) {
+  }
+}
+
+// Stream channel that sends the first frame after the request with a size larger than the maximum of the server,
+// the rest of the stream is not sent.
+struct OversizedStreamChannel: IpcCall::StreamChannel {
+  explicit OversizedStreamChannel(const std::string& path) : fd(IpcCall::SocketConnect(path)) {}
+
+  ~OversizedStreamChannel() override {
+    close(fd);
+  }
+
+  void Write(IpcCall::FrameKind kind, const IpcCall::bytes_t& bytes) override {
+    if (kind == IpcCall::FrameKind::StreamRequest) {
+      IpcCall::SocketWriteFrame(fd, kind, bytes);
+    } else if (!oversized) {
+      const IpcCall::FrameHeader header = { kind, 0, IpcCall::SocketServer::DefaultMaxFrameSize + 1 };
+      write(fd, &header, sizeof(header));
+
+      oversized = true;
+    }
+  }
+
+  IpcCall::FrameKind Read(IpcCall::bytes_t& bytes) override {
+    IpcCall::FrameHeader header;
+    IpcCall::SocketReadAll(fd, &header, sizeof(header));
+
+    bytes.resize(header.size);
+    IpcCall::SocketReadAll(fd, bytes.data(), bytes.size());
+
+    return header.kind;
+  }
+
+  int fd;
+  bool oversized = false;
+};
+
+static void SocketClientProcess(const std::string& path, int count) {
+  IpcCall::SocketClient client(path);
+
+  // The server closes a connection that sends a frame larger than its maximum, the frame is not allocated.
+  {
+    const int fd = IpcCall::SocketConnect(path);
+
+    const IpcCall::FrameHeader header = { IpcCall::FrameKind::SyncRequest, 0, IpcCall::SocketServer::DefaultMaxFrameSize + 1 };
+    const auto written = write(fd, &header, sizeof(header));
+
+    char byte;
+    const auto received = read(fd, &byte, sizeof(byte));
+    close(fd);
+
+    assert(written == sizeof(header) && received == 0);
+  }
+
+  // A stream frame larger than the maximum fails the call, the frame is not allocated.
+  try {
+    IPC_SEND_RECEIVE(Import)(IpcCall::InStream<Record>([sent = false](Record& record) mutable {
+      record = { "Record", 0 };
+      return !std::exchange(sent, true);
+    }))([&] { return std::make_shared<OversizedStreamChannel>(path); });
+
+    assert(false);
+  } catch (const std::runtime_error& e) {
+    assert(std::string(e.what()) == "IPC socket frame is too large");
+  }
+
+  IPC_SEND(Store)("WSX")(client.Async());
+
+  const double latency = MeasureLatency(client.Sync(), count);
+
+  std::cout << "Unix domain socket: " << latency << " us per round trip" << std::endl;
+
+  const double pipelinedLatency = MeasurePipelinedLatency(client.Future(), count);
+
+  std::cout << "Unix domain socket, pipelined: " << pipelinedLatency << " us per call" << std::endl;
+
+  const double batchedLatency = MeasureBatchedLatency(client.Sync(), count);
+
+  std::cout << "Unix domain socket, batched: " << batchedLatency << " us per call" << std::endl;
+
+  // Streams in both directions, every call has its own connection.
+  const int streamCount = count * 10;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  int sent = 0;
+  const auto imported = IPC_SEND_RECEIVE(Import)(IpcCall::InStream<Record>([&](Record& record) {
+    if (sent == streamCount) {
+      return false;
+    }
+
+    record = { "Record", sent++ };
+    return true;
+  }))(client.Stream());
+
+  assert(imported == static_cast<size_t>(streamCount));
+
+  auto records = IPC_SEND_RECEIVE(Export)(streamCount)(client.Stream());
+
+  int received = 0;
+  for (Record record; records.Read(record); received++) {
+    assert(std::get<1>(record) == received);
+  }
+
+  assert(received == streamCount);
+
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "Unix domain socket, streams: " << static_cast<uint64_t>(2 * streamCount / elapsed.count()) << " records/s" << std::endl;
+
+  // Synchronous calls after pipelined, their replies are received by the reader thread.
+  assert(IPC_SEND_RECEIVE(Add)(1, 2)(client.Sync()) == 3);
+}
+
+static std::string s_stored;
+
+int main(int argc, char** argv) {
+  const int count = argc > 1 ? std::stoi(argv[1]) : 100000;
+
+  // Shared memory, the server with a maximum frame of 4 KiB.
+  {
+    const std::string name = "/ipccall-limits-" + std::to_string(getpid());
+
+    IpcCall::ShmServer server(name, IpcCall::ShmChannel::DefaultCapacity, 0, 4096);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+      ShmLimitsClientProcess(name);
+      _exit(0);
+    }
+
+    // It returns when the channel is closed.
+    server.Run();
+
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  // Shared memory, sleeping and spinning wait.
+  for (const unsigned spinCount : { 0u, 100000u }) {
+    const std::string name = "/ipccall-" + std::to_string(getpid());
+
+    IpcCall::ShmServer server(name, IpcCall::ShmChannel::DefaultCapacity, spinCount);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+      // The child doesn't destroy the copy of 'server'.
+      ShmClientProcess(name, spinCount, count);
+      _exit(0);
+    }
+
+    server.Run();
+
+    assert(s_stored == "QAZ");
+
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  // Unix domain socket.
+  const std::string path = "/tmp/ipccall-" + std::to_string(getpid()) + ".sock";
+
+  IpcCall::SocketServer server(path);
+
+  const pid_t pid = fork();
+  if (pid == 0) {
+    SocketClientProcess(path, count);
+    _exit(0);
+  }
+
+  // Stop the server when the client exits.
+  std::thread waiter([&] {
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    server.Stop();
+  });
+
+  server.Run();
+  waiter.join();
+
+  assert(s_stored == "WSX");
+}
+
+
+//
+// Server
+//
+
+// 'Add' implementation.
+int Add(int a, int b) {
+  return a + b;
+}
+IPC_CALL_REGISTER(Add);
+
+// 'Store' implementation.
+void Store(const std::string& s) {
+  s_stored = s;
+}
+IPC_CALL_REGISTER(Store);
+
+// 'Fail' implementation.
+void Fail() {
+  throw 1;
+}
+IPC_CALL_REGISTER(Fail);
+
+// 'Import' implementation, the records are consumed as they are received.
+size_t Import(IpcCall::InStream<Record> records) {
+  size_t count = 0;
+
+  for (Record record; records.Read(record); count++) {
+    assert(std::get<1>(record) == static_cast<int>(count));
+  }
+
+  return count;
+}
+IPC_CALL_REGISTER(Import);
+
+// 'Export' implementation, the records are produced as they are sent.
+IpcCall::OutStream<Record> Export(int count) {
+  return IpcCall::OutStream<Record>([count, i = 0](Record& record) mutable {
+    if (i == count) {
+      return false;
+    }
+
+    record = { "Record", i++ };
+    return true;
+  });
+}
+IPC_CALL_REGISTER(Export);